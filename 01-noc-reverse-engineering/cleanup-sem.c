@@ -6,10 +6,6 @@
 
 int main(int argc, char const *argv[])
 {
-	if (sem_unlink("setup_sem") != 0) {
-		perror("Unlink setup_sem");
-	}
-
 	if (sem_unlink("tx_ready") != 0) {
 		perror("Unlink tx_ready");
 	}
@@ -1,4 +1,6 @@
+import os
 import subprocess
+import sys
 from collections import namedtuple
 
 import numpy as np
@@ -15,6 +17,17 @@ DIE_LAYOUT = [
     [3, 8, -1, 16, 21, 25]
 ]
 
+# Layout of this machine, if tools/topology-discovery generated it
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '04-analytical-model'))
+try:
+    from topology import DIE_LAYOUT
+except ImportError:
+    pass
+
+# Trace reader shared by the experiments
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from trace_file import read_columns
+
 
 def print_coord(slice_id):
     """Return a string that represents slice_id using the notation from the paper."""
@@ -45,7 +58,7 @@ def test_placement(p):
 
 
 def load_trace(filepath):
-    return np.genfromtxt(filepath, delimiter=' ')
+    return np.column_stack(read_columns(filepath))
 
 
 def filter_trace(trace, percentile=10):
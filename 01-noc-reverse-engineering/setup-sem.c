@@ -7,11 +7,6 @@
 
 int main(int argc, char const *argv[])
 {
-	if (sem_open("setup_sem", O_CREAT | O_EXCL, 0600, 1) == SEM_FAILED) {
-		perror("Opening setup_sem");
-		return -1;
-	}
-
 	if (sem_open("tx_ready", O_CREAT | O_EXCL, 0600, 0) == SEM_FAILED) {
 		perror("Opening tx_ready");
 		return -1;
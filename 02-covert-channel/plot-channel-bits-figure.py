@@ -4,16 +4,13 @@ import sys
 import matplotlib.pyplot as plt
 import numpy as np
 
+# Trace reader shared by the experiments
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from trace_file import read_columns
+
 
 def read_from_file(filename):
-    result_x = []
-    result_y = []
-    # Results of all runs are all in the same file
-    with open(filename) as f:
-        for line in f:
-            x, y = line.strip().split()
-            result_x.append(int(x))
-            result_y.append(int(y))
+    result_x, result_y = read_columns(filename)[:2]
     return result_x, result_y
 
 
@@ -1,9 +1,15 @@
 import argparse
 import multiprocessing as mp
+import os
+import sys
 from collections import namedtuple
 
 import numpy as np
 
+# Trace reader shared by the experiments
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from trace_file import read_trace
+
 ParseParams = namedtuple('ParseParams', 'interval offset contention_frac threshold score')
 interval = None
 result_x = None
@@ -26,16 +32,26 @@ train_intv_end = train_intv_start + train_intervals
 test_intv_start = discard_intervals + train_intervals
 test_intv_end = test_intv_start + test_intervals
 
-def read_from_file(filename):
-    """Read a 2-column receiver trace file."""
-    result_x = []
-    result_y = []
-    with open(filename) as f:
-        for line in f:
-            x, y = line.strip().split()
-            result_x.append(int(x))
-            result_y.append(int(y))
-    return result_x, result_y
+def read_samples(trace):
+    """Read the samples of a 2-column receiver trace."""
+    result_x, result_y = trace.columns[:2]
+    # The workers index the samples one by one, which is faster on lists
+    return result_x.tolist(), result_y.tolist()
+
+
+def read_windows(trace):
+    """Read the per-window statistics of an aggregated receiver trace.
+
+    Returns the sample counts and the counts above the threshold of every
+    window from the first one on, windows without samples included.
+    """
+    names = trace.info['column_names']
+    window, count, above = (trace.columns[names.index(n)].astype(np.int64) for n in ('window', 'count', 'above'))
+    counts = np.zeros(window[-1] - window[0] + 1, dtype=np.int64)
+    aboves = np.zeros_like(counts)
+    counts[window - window[0]] = count
+    aboves[window - window[0]] = above
+    return counts, aboves
 
 
 def diff_letters(a, b):
@@ -60,6 +76,38 @@ def parse_intervals_into_bits(intervals, threshold, min_contention_frac):
             result += "0"
     return result
 
+def score_training_bits(result):
+    """Count the bit errors of the bits decoded from the training set."""
+    if random_pattern:
+        # Because we don't know at what point in the random sequence of
+        # bits we started sampling, we need to test against all possible
+        # shifts of the pattern. This is *much* faster in numpy, so we
+        # convert to np arrays for this step.
+        score = patternlen
+
+        nppattern = np.array([int(i) for i in pattern])
+        result = np.array([int(i) for i in result])
+        for i in range(patternlen):
+            # This is what the numpy function below is effectively doing:
+            # candidate = pattern[i:] + pattern[:i]
+            # newscore = diff_letters(result, candidate)
+            newscore = np.count_nonzero(np.roll(nppattern, i) != result)
+            if (newscore < score):
+                score = newscore
+    else:
+        # Compare these bits with the ground truth
+        # The ground truth is either 0101... or 1010...
+        candidate_1 = "01" * (len(result) // 2)
+        candidate_2 = "10" * (len(result) // 2)
+
+        # Get the number of bit flips between the decoded stream and the
+        # (correct) ground truth
+        score_1 = diff_letters(result, candidate_1)
+        score_2 = diff_letters(result, candidate_2)
+        score = min(score_1, score_2)
+    return score
+
+
 def per_offset_worker(parse_params):
     """For a given offset, find the optimal threshold and contention_frac values.
     
@@ -107,34 +155,8 @@ def per_offset_worker(parse_params):
             # Parse the intervals into bits
             result = parse_intervals_into_bits(train_intervals, threshold, min_contention_frac / 100)
 
-            if random_pattern:
-                # Because we don't know at what point in the random sequence of
-                # bits we started sampling, we need to test against all possible
-                # shifts of the pattern. This is *much* faster in numpy, so we
-                # convert to np arrays for this step.
-                score = patternlen
-
-                nppattern = np.array([int(i) for i in pattern])
-                result = np.array([int(i) for i in result])
-                for i in range(patternlen):
-                    # This is what the numpy function below is effectively doing:
-                    # candidate = pattern[i:] + pattern[:i]
-                    # newscore = diff_letters(result, candidate)
-                    newscore = np.count_nonzero(np.roll(nppattern, i) != result)
-                    if (newscore < score):
-                        score = newscore
-            else:
-                # Compare these bits with the ground truth
-                # The ground truth is either 0101... or 1010...
-                candidate_1 = "01" * (len(result) // 2)
-                candidate_2 = "10" * (len(result) // 2)
-
-                # Get the number of bit flips between the decoded stream and the
-                # (correct) ground truth
-                score_1 = diff_letters(result, candidate_1)
-                score_2 = diff_letters(result, candidate_2)
-                score = min(score_1, score_2)
-            
+            score = score_training_bits(result)
+
             # Pick the best score
             if (score <= best_score):
                 best_threshold = threshold
@@ -142,6 +164,61 @@ def per_offset_worker(parse_params):
                 best_score = score
     return ParseParams(interval, offset, best_contention_frac, best_threshold, best_score)
 
+def score_test_bits(result):
+    """Count the bit errors of the bits decoded from the test set."""
+    if random_pattern:
+        score = SCORE_MAX
+        best_offset = 0
+
+        # Find the best offset using the first patternlen intervals
+        nppattern = np.array([int(i) for i in pattern])
+        npresult = np.array([int(i) for i in result])
+        for i in range(patternlen):
+            newscore = np.count_nonzero(np.roll(nppattern, i) != npresult[:patternlen])
+            if (newscore < score):
+                best_offset = i
+                score = newscore
+        
+        # Evaluate on the entire collected result
+        extended_pattern = np.tile(nppattern, len(result) // patternlen + 1)[:len(result)]
+        score = np.count_nonzero(np.roll(extended_pattern, best_offset) != npresult)
+    else:
+        # Compare these bits with the ground truth
+        # The ground truth is either 0101... or 1010...
+        candidate_1 = "01" * ((len(result) // 2) + 1)
+        candidate_2 = "10" * ((len(result) // 2) + 1)
+
+        # Print the number of bit flips between the
+        # decoded stream and the (correct) ground truth
+        score_1 = diff_letters(result, candidate_1[:len(result)])
+        score_2 = diff_letters(result, candidate_2[:len(result)])
+        score = min(score_1, score_2)
+    return score
+
+
+def main_windows(trace):
+    """Count the bit errors of an aggregated receiver trace.
+
+    The receiver already bucketed the samples by interval with its
+    threshold, so only the fraction of contention samples is trained.
+    """
+    counts, aboves = read_windows(trace)
+    train = slice(train_intv_start, train_intv_end)
+    test = slice(test_intv_start, test_intv_end)
+
+    best_contention_frac = None
+    best_score = SCORE_MAX
+    for min_contention_frac in range(1, 100, 1):
+        bits = aboves[train] > min_contention_frac / 100 * counts[train]
+        score = score_training_bits(''.join('1' if b else '0' for b in bits))
+        if (score <= best_score):
+            best_contention_frac = min_contention_frac / 100
+            best_score = score
+
+    bits = aboves[test] > best_contention_frac * counts[test]
+    print(score_test_bits(''.join('1' if b else '0' for b in bits)))
+
+
 def main():
     global interval, result_x, result_y, random_pattern
 
@@ -154,11 +231,15 @@ def main():
         default=False
     )
     args = parser.parse_args()
-
-    result_x, result_y = read_from_file(args.result_path)
     interval = args.interval
     random_pattern = args.random_pattern
 
+    trace = read_trace(args.result_path)
+    if 'window' in trace.info.get('column_names', []):
+        main_windows(trace)
+        return
+    result_x, result_y = read_samples(trace)
+
     # Parse trace into intervals
     pool = mp.Pool(processes=40)
     offsets = range(0, interval // 2, interval // 80)
@@ -193,33 +274,7 @@ def main():
     # Parse the intervals into bits
     result = parse_intervals_into_bits(test_intervals, best_threshold, best_contention_frac)
 
-    if random_pattern:
-        score = SCORE_MAX
-        best_offset = 0
-
-        # Find the best offset using the first patternlen intervals
-        nppattern = np.array([int(i) for i in pattern])
-        npresult = np.array([int(i) for i in result])
-        for i in range(patternlen):
-            newscore = np.count_nonzero(np.roll(nppattern, i) != npresult[:patternlen])
-            if (newscore < score):
-                best_offset = i
-                score = newscore
-        
-        # Evaluate on the entire collected result
-        extended_pattern = np.tile(nppattern, len(result) // patternlen + 1)[:len(result)]
-        score = np.count_nonzero(np.roll(extended_pattern, best_offset) != npresult)
-    else:
-        # Compare these bits with the ground truth
-        # The ground truth is either 0101... or 1010...
-        candidate_1 = "01" * ((len(result) // 2) + 1)
-        candidate_2 = "10" * ((len(result) // 2) + 1)
-
-        # Print the number of bit flips between the
-        # decoded stream and the (correct) ground truth
-        score_1 = diff_letters(result, candidate_1[:len(result)])
-        score_2 = diff_letters(result, candidate_2[:len(result)])
-        score = min(score_1, score_2)
+    score = score_test_bits(result)
 
     # print('Errors: {}/{} ({}%)'.format(score, len(result), score * 100 / len(result)))
     print(score)
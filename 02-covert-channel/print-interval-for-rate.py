@@ -1,10 +1,25 @@
+import os
 import sys
 
 
+def read_tick_ghz(path):
+    # The generic timer is the one the transmitter and the receiver synchronize on
+    with open(path) as f:
+        for line in f:
+            key, _, value = line.strip().partition("=")
+            if key == "generic.tick_ghz":
+                return float(value)
+    sys.exit(f"No generic.tick_ghz in {path}, regenerate it with tools/timer-benchmark")
+
+
 def main():
     # Parse args
-    assert len(sys.argv) == 3, "Specify the CPU frequency in GHz and the desired bitrate in Mbps"
-    proc_frequency = float(sys.argv[1]) * 10**9   # e.g., 3*10^9
+    assert len(sys.argv) == 3, "Specify the timer config of tools/timer-benchmark (or the timer frequency in GHz) and the desired bitrate in Mbps"
+    if os.path.isfile(sys.argv[1]):
+        tick_ghz = read_tick_ghz(sys.argv[1])
+    else:
+        tick_ghz = float(sys.argv[1])
+    proc_frequency = tick_ghz * 10**9             # e.g., 0.125*10^9
     goal_Mbps = float(sys.argv[2])                # e.g., 1
 
     # Compute the interval that the channel needs to use to achieve the desired bitrate
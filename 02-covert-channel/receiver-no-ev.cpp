@@ -1,22 +1,88 @@
 #include "../util/util.h"
 #include "../util/machine_const.h"
+#include "../util/slice_cache.h"
+#include "../util/slice_classifier.h"
+#include "../util/eviction_set_builder.h"
+#include "../util/shared_pool.h"
+#include "../util/timer_config.h"
+#include "../util/trace_file.h"
+#include "../util/trace_stream.h"
+#include "../util/window_stats.h"
+#include "../util/probe_kernel.h"
 #include <semaphore.h>
+#include <signal.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <string.h>
 
 #define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
 
+// A single LLC hit is shorter than one tick of the generic timer, so by
+// default each sample times several loads. The PMU cycle counter resolves one.
+#ifdef TIMER_PMU
+#define DEFAULT_PROBE_KERNEL "1-load"
+#else
+#define DEFAULT_PROBE_KERNEL "4-load"
+#endif
+
+// A record of a streamed trace. The timestamps of a long recording
+// overflow 32 bits, so they are 64-bit here.
+struct __attribute__((packed)) stream_sample {
+	uint64_t timestamp;
+	uint32_t latency;
+};
+
+static volatile sig_atomic_t stop_requested;
+
+static void request_stop(int sig)
+{
+	(void)sig;
+	stop_requested = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 int main(int argc, char **argv)
 {
 	int i;
 
+	// Parse options
+	const char *kernel_name = DEFAULT_PROBE_KERNEL;
+	const char *program = argv[0];
+	bool bad_option = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "k:")) != -1) {
+		if (opt == 'k') {
+			kernel_name = optarg;
+		} else {
+			bad_option = true;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+
 	// Check arguments
-	if (argc != 5) {
+	if (bad_option || argc < 5 || argc > 7) {
 		fprintf(stderr, "Wrong Input! Enter desired core ID, slice ID, output filename, and channel interval!\n");
-		fprintf(stderr, "Enter: %s <core_ID> <slice_ID> <output_filename> <interval>\n", argv[0]);
+		fprintf(stderr, "Enter: %s [-k kernel] <core_ID> <slice_ID> <output_filename> <interval> [stream_seconds [threshold]]\n",
+				program);
+		fprintf(stderr, "The probe kernel times each sample (see util/probe_kernel.h), " DEFAULT_PROBE_KERNEL " by default\n");
+		fprintf(stderr, "With stream_seconds, samples are streamed to the output (- for stdout) for that long,\n"
+						"or until interrupted if it is 0, instead of taking a fixed number of them\n");
+		fprintf(stderr, "With a threshold, only per-interval statistics are streamed (see util/window_stats.h)\n");
 		exit(1);
 	}
 
+	// Select the probe kernel
+	const struct probe_kernel *kernel = probe_kernel_select(kernel_name, TIMER_BACKEND);
+
 	// Parse core ID
 	int core_ID;
 	sscanf(argv[1], "%d", &core_ID);
@@ -37,7 +103,19 @@ int main(int argc, char **argv)
 	int set_ID = 33;
 
 	// Prepare output filename
-	FILE *output_file = fopen(argv[3], "w");
+	const char *output_filename = argv[3];
+
+	// Parse streaming duration and aggregation threshold
+	bool streaming = argc >= 6;
+	double stream_seconds = streaming ? atof(argv[5]) : 0;
+	bool aggregating = argc == 7;
+	uint32_t threshold = 0;
+	if (aggregating) {
+		sscanf(argv[6], "%" PRIu32, &threshold);
+	}
+	if (streaming && strcmp(output_filename, "-") == 0) {
+		trace_stream_reserve_stdout();
+	}
 
 	// Parse channel interval
 	uint32_t interval = 1; // C does not like this if not initialized
@@ -53,82 +131,86 @@ int main(int argc, char **argv)
 	// doing so would use root and we want our actual attack
 	// to be realistic for a user space process
 	pin_cpu(core_ID);
+	timer_init();
 
 	//////////////////////////////////////////////////////////////////////
 	// Set up memory
 	//////////////////////////////////////////////////////////////////////
 
-	// Mutex to avoid colliding with tx when creating EVs
-	// This is unnecessary when using the hash function
-	sem_t *setup_sem = sem_open("setup_sem", 0);
-	if (setup_sem == SEM_FAILED) {
-		perror("rx sem_open cha_pmon_sem");
-		return -1;
-	}
-	sem_wait(setup_sem);
-
-	// Allocate large buffer (pool of addresses)
-	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
-	if (buffer == MAP_FAILED) {
-		perror("mmap");
-		exit(1);
-	}
-
-	// Write data to the buffer so that any copy-on-write
-	// mechanisms will give us our own copies of the pages.
-	memset(buffer, 0, BUF_SIZE);
+	// Map the address pool shared with the other processes of the experiment
+	struct shared_pool *pool = shared_pool_open(SHARED_POOL_NAME, BUF_SIZE, HUGEPAGE_SHIFT);
 
 	// Prepare monitoring set
 	printf("Rx: starting setup\n");
 	int monitoring_set_size = 24;
-	struct Node *monitoring_set = NULL;
-	struct Node *curr_node = NULL;
-	uint64_t index1, index2, offset;
-
-	// Find first address in our desired slice and given set
-	offset = find_next_address_on_slice_and_set(buffer, slice_ID, set_ID);
-
-	// Save this address in the monitoring set
-	append_string_to_linked_list(&monitoring_set, (void *)((uint64_t)buffer + offset));
+	struct slice_index *index = pool->index;
 
-	// Get the L1 and L2 cache set indexes of the monitoring set
-	index2 = get_cache_set_index((uint64_t)monitoring_set->address, 2);
-	index1 = get_cache_set_index((uint64_t)monitoring_set->address, 1);
+	// Avoid colliding with the other processes when creating EVs
+	// This is unnecessary when using the hash function
+	slice_index_setup_lock(index);
 
-	// Find next addresses which are residing in the desired slice and the same sets in L2/L1
+	// Find addresses which are residing in the desired slice and given set,
+	// and in the same sets in L2/L1 as the first one
 	// These addresses will distribute across 2 LLC sets
-	curr_node = monitoring_set;
-	for (i = 1; i < monitoring_set_size; i++) {
-		offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-		while (index1 != get_cache_set_index((uint64_t)curr_node->address + offset, 1) ||
-			   index2 != get_cache_set_index((uint64_t)curr_node->address + offset, 2) ||
-			   slice_ID != get_cache_slice_index((void *)((uint64_t)curr_node->address + offset))) {
-			offset += L2_INDEX_STRIDE;
-		}
-
-		append_string_to_linked_list(&monitoring_set, (void *)((uint64_t)curr_node->address + offset));
-		curr_node = curr_node->next;
-	}
-
-	curr_node->next = monitoring_set; // Loop back to the beginning
+	uint32_t sets[] = {(uint32_t)set_ID};
+	struct ev_spec spec = {slice_ID, sets, 1, monitoring_set_size, EV_LAYOUT_SEQUENTIAL};
+	struct flat_ev *monitoring_set = build_flat_ev(index, &spec, 1);
+	struct probe_cursor cursor;
+	probe_cursor_init(&cursor, kernel, monitoring_set);
 
 	// Flush monitoring set
-	// curr_node = monitoring_set;
-	// for (i = 0; i < monitoring_set_size; i++) {
-	// 	_mm_clflush(curr_node->address);
-	// 	curr_node = curr_node->next;
-	// }
+	// flat_ev_flush(monitoring_set);
 
-	// Prepare samples array
+	// Describe the trace
+	char placement[80];
+	snprintf(placement, sizeof(placement), "core=%d slice=%d set=%d", core_ID, slice_ID, set_ID);
+	if (aggregating) {
+		snprintf(placement + strlen(placement), sizeof(placement) - strlen(placement), " threshold=%" PRIu32, threshold);
+	}
+	struct trace_info info;
+	trace_info_init(&info, TIMER_BACKEND, kernel->loads);
+#ifdef TIMER_PMU
+	info.timestamp_ghz = perf_timer_get_calibration()->tick_ghz;
+	info.latency_ghz = perf_timer_get_calibration()->cycle_ghz;
+#endif
+	info.interval = interval;
+	info.kernel = kernel->name;
+	info.placement = placement;
+
+	// Prepare samples array, or the stream
 	const int repetitions = 4000000;
-	uint32_t *result_x = (uint32_t *)malloc(sizeof(*result_x) * repetitions);
-	uint32_t *result_y = (uint32_t *)malloc(sizeof(*result_y) * repetitions);
+	uint32_t *result_x = NULL;
+	uint32_t *result_y = NULL;
+	struct trace_stream *stream = NULL;
+	if (aggregating) {
+		// Few enough records that they are never compressed
+		stream = trace_stream_open_layout(output_filename, &info, window_stats_fields, 5, sizeof(struct window_stats), -1,
+										  TRACE_LAYOUT_RECORDS);
+		signal(SIGINT, request_stop);
+		signal(SIGTERM, request_stop);
+	} else if (streaming) {
+		struct trace_field fields[] = {
+			{"timestamp", offsetof(struct stream_sample, timestamp), sizeof(uint64_t)},
+			{"latency", offsetof(struct stream_sample, latency), sizeof(uint32_t)},
+		};
+		stream = trace_stream_open(output_filename, &info, fields, 2, sizeof(struct stream_sample), -1);
+		signal(SIGINT, request_stop);
+		signal(SIGTERM, request_stop);
+	} else {
+		result_x = (uint32_t *)malloc(sizeof(*result_x) * repetitions);
+		result_y = (uint32_t *)malloc(sizeof(*result_y) * repetitions);
+	}
 
-	printf("Rx: Done with setup\n");
+	printf("Rx: Done with setup, timing samples with the %s kernel and the " TIMER_NAME "\n", kernel->name);
+#ifdef TIMER_PMU
+	perf_timer_print_calibration(stdout);
+#endif
+	timer_config_check(TIMER_BACKEND, kernel->loads);
+	slice_cache_print_stats();
+	slice_classifier_print_stats();
 
-	// Release setup mutex
-	sem_post(setup_sem);
-	sem_close(setup_sem);
+	// Release the setup lock
+	slice_index_setup_unlock(index);
 	// Barrier for experiment start
 	sem_t *tx_ready = sem_open("tx_ready", 0);
 	sem_t *rx_ready = sem_open("rx_ready", 0);
@@ -145,11 +227,8 @@ int main(int argc, char **argv)
 
 	// Read monitoring set from memory into cache
 	// The addresses should all fit in the LLC
-	curr_node = monitoring_set;
-	for (i = 0; i < 1000000 * monitoring_set_size; i++) {
-		// _mm_lfence();
-		maccess(curr_node->address);
-		curr_node = curr_node->next;
+	for (i = 0; i < 1000000; i++) {
+		flat_ev_load(monitoring_set);
 	}
 
 	// Synchronize
@@ -158,56 +237,67 @@ int main(int argc, char **argv)
 		cycles = get_time();
 	} while ((cycles % interval) > 10);
 
-	// Time LLC loads
-	for (i = 0; i < repetitions; i++) {
-		uint64_t start, end;
-		// Access the addresses sequentially.
-		// asm volatile(
-		// 	".balign 16\n\t"
-		// 	"isb\n\t"
-		// 	"mrs %0, cntvct_el0\n\t"
-		// 	"ldr x9, [%2]\n\t"
-		// 	"ldr x9, [%3]\n\t"
-		// 	"ldr x9, [%4]\n\t"
-		// 	"ldr x9, [%5]\n\t"
-		// 	"mrs %1, cntvct_el0\n\t"			
-		// 	: "=r"(start), "=r"(end) /*output*/
-		// 	: "r"(curr_node->address), "r"(curr_node->next->address) , "r"(curr_node->next->next->address), "r"(curr_node->next->next->next->address)
-		// 	: "x9");
-		
-		void* p1 = curr_node->address;
-		void* p2 = curr_node->next->address;
-		void* p3 = curr_node->next->next->address;
-		void* p4 = curr_node->next->next->next->address;
-
-		asm volatile("isb");
-		asm volatile("mrs %0, cntvct_el0":"=r"(start));
-		maccess(p1);
-		maccess(p2);
-		maccess(p3);
-		maccess(p4);
-		asm volatile("isb");
-		asm volatile("mrs %0, cntvct_el0":"=r"(end));
-
-		
-		result_x[i] = start;
-		result_y[i] = end-start;
-		
-		curr_node = curr_node->next->next->next->next;
-	}
+	// Time LLC loads, with the timestamps relative to the first one
+	uint64_t timestamp;
+	uint32_t latency;
+	if (streaming) {
+		// The deadline is checked once per block of samples
+		uint64_t deadline = stream_seconds > 0 ? now_ns() + (uint64_t)(stream_seconds * 1e9) : UINT64_MAX;
+		uint64_t first_timestamp = 0;
+		// Windows start on the bits of the transmitter, which synchronizes the same way
+		struct window_aggregator agg;
+		window_aggregator_init(&agg, stream, cycles - cycles % interval, interval, threshold);
+		for (uint64_t n = 0; !stop_requested; n++) {
+			if (n % TRACE_STREAM_BLOCK_RECORDS == 0 && now_ns() >= deadline) {
+				break;
+			}
+			latency = probe_kernel_run(kernel, &cursor, &timestamp);
+			if (aggregating) {
+				window_aggregator_add(&agg, timestamp, latency);
+				continue;
+			}
+			if (n == 0) {
+				first_timestamp = timestamp;
+			}
+
+			struct stream_sample *record = (struct stream_sample *)trace_stream_slot(stream);
+			record->timestamp = timestamp - first_timestamp;
+			record->latency = latency;
+			trace_stream_commit(stream);
+		}
+		if (aggregating) {
+			window_aggregator_flush(&agg);
+			if (agg.late > 0) {
+				fprintf(stderr, "Rx: %" PRIu64 " samples were too late for their window\n", agg.late);
+			}
+		}
+		trace_stream_close(stream);
+	} else {
+		for (i = 0; i < repetitions; i++) {
+			latency = probe_kernel_run(kernel, &cursor, &timestamp);
+			result_x[i] = timestamp;
+			result_y[i] = latency;
+		}
 
-	// Store the samples to disk
-	for (i = 0; i < repetitions; i++) {
-		fprintf(output_file, "%" PRIu32 " %" PRIu32 "\n", result_x[i] - result_x[0], result_y[i]);
+		// Store the samples to disk
+		uint32_t first_timestamp = result_x[0];
+		for (i = 0; i < repetitions; i++) {
+			result_x[i] -= first_timestamp;
+		}
+		struct trace_column_data columns[] = {
+			{"timestamp", result_x, sizeof(*result_x), (uint64_t)repetitions},
+			{"latency", result_y, sizeof(*result_y), (uint64_t)repetitions},
+		};
+		trace_write(output_filename, &info, columns, 2);
 	}
 
-	// Free the buffers and file
-	munmap(buffer, BUF_SIZE);
-	fclose(output_file);
+	// Free the buffers
+	shared_pool_close(pool);
 	sem_close(tx_ready);
 	sem_close(rx_ready);
 	free(result_x);
 	free(result_y);
+	flat_ev_free(monitoring_set);
 
 	return 0;
 }
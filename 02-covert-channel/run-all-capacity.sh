@@ -1,7 +1,12 @@
 #!/bin/bash
 cd "${BASH_SOURCE%/*}/" || exit # cd into correct directory
 
-CPU_GHZ=0.125
+# Timer characterization written by tools/timer-benchmark
+TIMER_CONFIG=${TIMER_CONFIG:-../timer.conf}
+if [ ! -f "$TIMER_CONFIG" ]; then
+	echo "WARNING: $TIMER_CONFIG not found (run tools/timer-benchmark), assuming a 0.125 GHz timer"
+	TIMER_CONFIG=0.125
+fi
 
 rm -rf out/capacity-data.out
 ./setup.sh
@@ -12,7 +17,7 @@ for ITERATION in {1..5}; do
 		
 		# Compute interval for the desired bitrate
 		source ../venv/bin/activate
-		INTERVAL=$(python print-interval-for-rate.py $CPU_GHZ $BITRATE)
+		INTERVAL=$(python print-interval-for-rate.py $TIMER_CONFIG $BITRATE)
 		deactivate
 
 		# Kill previous processes
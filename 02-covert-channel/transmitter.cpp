@@ -1,5 +1,9 @@
 #include "../util/util.h"
 #include "../util/machine_const.h"
+#include "../util/slice_cache.h"
+#include "../util/slice_classifier.h"
+#include "../util/eviction_set_builder.h"
+#include "../util/shared_pool.h"
 #include <semaphore.h>
 #include <sys/mman.h>
 #include <string.h>
@@ -52,171 +56,31 @@ int main(int argc, char **argv)
 	// Set up memory
 	//////////////////////////////////////////////////////////////////////
 
-	// Mutex to avoid colliding with tx when creating EVs
-	// This is unnecessary when using the hash function
-	sem_t *setup_sem = sem_open("setup_sem", 0);
-	if (setup_sem == SEM_FAILED) {
-		perror("rx sem_open cha_pmon_sem");
-		return -1;
-	}
-	sem_wait(setup_sem);
-
-	// Allocate large buffer (pool of addresses)
-	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
-	if (buffer == MAP_FAILED) {
-		perror("mmap");
-		exit(1);
-	}
-
-	// Write data to the buffer so that any copy-on-write
-	// mechanisms will give us our own copies of the pages.
-	memset(buffer, 0, BUF_SIZE);
+	// Map the address pool shared with the other processes of the experiment
+	struct shared_pool *pool = shared_pool_open(SHARED_POOL_NAME, BUF_SIZE, HUGEPAGE_SHIFT);
 
 	printf("Tx: starting setup\n");
 
 	// EV preparation variables
-	int l2_set_1 = 0;
-	int l2_set_2 = 165;
+	uint32_t l2_sets[] = {0, 165};
 	int n_of_l2_sets_per_ev = 2;
 	int n_of_ev_addresses_per_l2_set = 20;
-	struct Node *ev_1 = NULL, *ev_2 = NULL;
-	struct Node *current = NULL;
-	uint64_t index1, index2, offset;
-
-	//////////////////////////////////////////////////////////////////////
-	// Prepare first EV (remote)
-	//////////////////////////////////////////////////////////////////////
-
-	// Find first address in our desired slice and the first set of the EV
-	offset = find_next_address_on_slice_and_set(buffer, slice_ID, l2_set_1);
-
-	// Save this address in the monitoring set
-	append_string_to_linked_list(&ev_1, (void *)((uint64_t)buffer + offset));
-
-	// Get the L1 and L2 cache set indexes of the monitoring set
-	index2 = get_cache_set_index((uint64_t)ev_1->address, 2);
-	index1 = get_cache_set_index((uint64_t)ev_1->address, 1);
-
-	// Find next addresses which are residing in the desired slice and the same sets in L2/L1
-	// These addresses will distribute across 2 LLC sets
-	current = ev_1;
-	for (i = 1; i < n_of_ev_addresses_per_l2_set; i++) {
-		offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-		while (index1 != get_cache_set_index((uint64_t)current->address + offset, 1) ||
-			   index2 != get_cache_set_index((uint64_t)current->address + offset, 2) ||
-			   slice_ID != get_cache_slice_index((void *)((uint64_t)current->address + offset))) {
-			offset += L2_INDEX_STRIDE;
-		}
-
-		append_string_to_linked_list(&ev_1, (void *)((uint64_t)current->address + offset));
-		current = current->next;
-	}
-
-	// Find first address in our desired slice and the second set of the EV
-	offset = find_next_address_on_slice_and_set(buffer, slice_ID, l2_set_2);
-
-	// Save this address in the monitoring set
-	append_string_to_linked_list(&ev_2, (void *)((uint64_t)buffer + offset));
-
-	// Get the L1 and L2 cache set indexes of the monitoring set
-	index2 = get_cache_set_index((uint64_t)ev_2->address, 2);
-	index1 = get_cache_set_index((uint64_t)ev_2->address, 1);
-
-	// Find next addresses which are residing in the desired slice and the same sets in L2/L1
-	// These addresses will distribute across 2 LLC sets
-	current = ev_2;
-	for (i = 1; i < n_of_ev_addresses_per_l2_set; i++) {
-		offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-		while (index1 != get_cache_set_index((uint64_t)current->address + offset, 1) ||
-			   index2 != get_cache_set_index((uint64_t)current->address + offset, 2) ||
-			   slice_ID != get_cache_slice_index((void *)((uint64_t)current->address + offset))) {
-			offset += L2_INDEX_STRIDE;
-		}
-
-		append_string_to_linked_list(&ev_2, (void *)((uint64_t)current->address + offset));
-		current = current->next;
-	}
-
-	// Merge ev_1 and ev_2
-	struct Node *ev = NULL;
-	struct Node *head_1 = ev_1;
-	struct Node *head_2 = ev_2;
-	for (i = 0; i < n_of_ev_addresses_per_l2_set; i++) {
-		append_string_to_linked_list(&ev, head_1->address);
-		append_string_to_linked_list(&ev, head_2->address);
+	struct slice_index *index = pool->index;
 
-		head_1 = head_1->next;
-		head_2 = head_2->next;
-	}
-
-	//////////////////////////////////////////////////////////////////////
-	// Prepare second EV (local)
-	//////////////////////////////////////////////////////////////////////
-
-	ev_1 = NULL;
-	ev_2 = NULL;
-
-	// Find first address in our desired slice and the first set of the EV
-	offset = find_next_address_on_slice_and_set(buffer, core_ID, l2_set_1);
-
-	// Save this address in the monitoring set
-	append_string_to_linked_list(&ev_1, (void *)((uint64_t)buffer + offset));
-
-	// Get the L1 and L2 cache set indexes of the monitoring set
-	index2 = get_cache_set_index((uint64_t)ev_1->address, 2);
-	index1 = get_cache_set_index((uint64_t)ev_1->address, 1);
-
-	// Find next addresses which are residing in the desired slice and the same sets in L2/L1
-	// These addresses will distribute across 2 LLC sets
-	current = ev_1;
-	for (i = 1; i < n_of_ev_addresses_per_l2_set; i++) {
-		offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-		while (index1 != get_cache_set_index((uint64_t)current->address + offset, 1) ||
-			   index2 != get_cache_set_index((uint64_t)current->address + offset, 2) ||
-			   core_ID != get_cache_slice_index((void *)((uint64_t)current->address + offset))) {
-			offset += L2_INDEX_STRIDE;
-		}
-
-		append_string_to_linked_list(&ev_1, (void *)((uint64_t)current->address + offset));
-		current = current->next;
-	}
-
-	// Find first address in our desired slice and given set
-	offset = find_next_address_on_slice_and_set(buffer, core_ID, l2_set_2);
-
-	// Save this address in the monitoring set
-	append_string_to_linked_list(&ev_2, (void *)((uint64_t)buffer + offset));
-
-	// Get the L1 and L2 cache set indexes of the monitoring set
-	index2 = get_cache_set_index((uint64_t)ev_2->address, 2);
-	index1 = get_cache_set_index((uint64_t)ev_2->address, 1);
-
-	// Find next addresses which are residing in the desired slice and the same sets in L2/L1
-	// These addresses will distribute across 2 LLC sets
-	current = ev_2;
-	for (i = 1; i < n_of_ev_addresses_per_l2_set; i++) {
-		offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-		while (index1 != get_cache_set_index((uint64_t)current->address + offset, 1) ||
-			   index2 != get_cache_set_index((uint64_t)current->address + offset, 2) ||
-			   core_ID != get_cache_slice_index((void *)((uint64_t)current->address + offset))) {
-			offset += L2_INDEX_STRIDE;
-		}
-
-		append_string_to_linked_list(&ev_2, (void *)((uint64_t)current->address + offset));
-		current = current->next;
-	}
-
-	// Merge ev_1 and ev_2
-	struct Node *ev_local = NULL;
-	head_1 = ev_1;
-	head_2 = ev_2;
-	for (i = 0; i < n_of_ev_addresses_per_l2_set; i++) {
-		append_string_to_linked_list(&ev_local, head_1->address);
-		append_string_to_linked_list(&ev_local, head_2->address);
-
-		head_1 = head_1->next;
-		head_2 = head_2->next;
-	}
+	// Avoid colliding with the other processes when creating EVs
+	// This is unnecessary when using the hash function
+	slice_index_setup_lock(index);
+
+	// Each EV has addresses which are residing in the desired slice and in
+	// one of the two sets, and in the same sets in L2/L1 as the first address
+	// of that set (these addresses will distribute across 2 LLC sets).
+	// The addresses of the two sets alternate in the EV.
+	struct ev_spec specs[2] = {
+		{slice_ID, l2_sets, n_of_l2_sets_per_ev, n_of_ev_addresses_per_l2_set, EV_LAYOUT_INTERLEAVED},	// remote
+		{core_ID, l2_sets, n_of_l2_sets_per_ev, n_of_ev_addresses_per_l2_set, EV_LAYOUT_INTERLEAVED},	// local
+	};
+	struct flat_ev *ev = build_flat_ev(index, &specs[0], 1);
+	struct flat_ev *ev_local = build_flat_ev(index, &specs[1], 1);
 
 	//////////////////////////////////////////////////////////////////////
 	// Done setting up EVs
@@ -228,49 +92,42 @@ int main(int argc, char **argv)
 #endif
 
 	// Read both ev and ev_local from memory
-	current = ev;
-	i = 0;
-	while (current != NULL) {
+	for (i = 0; i < ev->size; i++) {
 		#ifdef DEBUG
-		printf("Tx EV %2d: %p: (%ld, %ld, %ld, %ld)\n", i, current->address,
-			   get_cache_set_index((uint64_t)(current->address), 1),
-			   get_cache_set_index((uint64_t)(current->address), 2),
-			   get_cache_set_index((uint64_t)(current->address), 3),
-			   get_cache_slice_index(current->address));
+		printf("Tx EV %2d: %p: (%ld, %ld, %ld, %ld)\n", i, ev->lines[i],
+			   get_cache_set_index((uint64_t)(ev->lines[i]), 1),
+			   get_cache_set_index((uint64_t)(ev->lines[i]), 2),
+			   get_cache_set_index((uint64_t)(ev->lines[i]), 3),
+			   get_cache_slice_index(ev->lines[i]));
 		#endif
-		asm volatile ("isb");
-		maccess(current->address);
-		current = current->next;
-		i++;
+		arch_fence();
+		maccess(ev->lines[i]);
 	}
 
-	i = 0;
-	current = ev_local;
-	while (current != NULL) {
+	for (i = 0; i < ev_local->size; i++) {
 		#ifdef DEBUG
-		printf("Tx EV_Local %2d: %p: (%ld, %ld, %ld, %ld)\n", i, current->address,
-			   get_cache_set_index((uint64_t)(current->address), 1),
-			   get_cache_set_index((uint64_t)(current->address), 2),
-			   get_cache_set_index((uint64_t)(current->address), 3),
-			   get_cache_slice_index(current->address));
+		printf("Tx EV_Local %2d: %p: (%ld, %ld, %ld, %ld)\n", i, ev_local->lines[i],
+			   get_cache_set_index((uint64_t)(ev_local->lines[i]), 1),
+			   get_cache_set_index((uint64_t)(ev_local->lines[i]), 2),
+			   get_cache_set_index((uint64_t)(ev_local->lines[i]), 3),
+			   get_cache_slice_index(ev_local->lines[i]));
 		#endif
-		asm volatile ("isb");
-		maccess(current->address);
-		current = current->next;
-		i++;
+		arch_fence();
+		maccess(ev_local->lines[i]);
 	}
 
-	asm volatile ("isb");
+	arch_fence();
 
 	//////////////////////////////////////////////////////////////////////
 	// Start CC
 	//////////////////////////////////////////////////////////////////////
 	
 	printf("Tx: Done with setup\n");
+	slice_cache_print_stats();
+	slice_classifier_print_stats();
 
-	// Release setup mutex
-	sem_post(setup_sem);
-	sem_close(setup_sem);
+	// Release the setup lock
+	slice_index_setup_unlock(index);
 	// Barrier for experiment start
 	sem_t *tx_ready = sem_open("tx_ready", 0);
 	sem_t *rx_ready = sem_open("rx_ready", 0);
@@ -300,16 +157,8 @@ int main(int argc, char **argv)
 		#endif
 			// Send 1 by spamming
 			while ((get_time() - start_t) < (interval * time)) {
-				current = ev;
-				while (current != NULL) {
-					maccess(current->address);
-					current = current->next;
-				}
-				current = ev_local;
-				while (current != NULL) {
-					maccess(current->address);
-					current = current->next;
-				}
+				flat_ev_load(ev);
+				flat_ev_load(ev_local);
 			}
 		} else {
 			// Send 0 by doing nothing
@@ -318,15 +167,14 @@ int main(int argc, char **argv)
 	}
 
 	// Free the buffer
-	munmap(buffer, BUF_SIZE);
+	shared_pool_close(pool);
 
 	sem_close(tx_ready);
 	sem_close(rx_ready);
 
-	// Clean up lists
-	struct Node *tmp = NULL;
-	for (current = ev; current != NULL; tmp = current, current = current->next, free(tmp));
-	for (current = ev_local; current != NULL; tmp = current, current = current->next, free(tmp));
+	// Clean up EVs
+	flat_ev_free(ev);
+	flat_ev_free(ev_local);
 
 	return 0;
 }
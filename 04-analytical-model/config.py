@@ -36,6 +36,12 @@ DIE_LAYOUT = [
     [3, 8, -1, 16, 21, 25]
 ]
 
+# Topology of this machine, if tools/topology-discovery generated it
+try:
+    from topology import CORES, SLICES, DIE_LAYOUT
+except ImportError:
+    pass
+
 #####################################
 # Lane scheduling policy
 #####################################
@@ -0,0 +1,111 @@
+/**
+ * flush-benchmark.cpp
+ *
+ * Compares flushing one line at a time (a flush and a barrier per line, as
+ * the experiments used to do) with the batched flushes of cache_flush.h,
+ * for sets of lines the size of an eviction set up to the whole hugepage
+ * pool. The lines are written before every round, so each flush also
+ * writes a dirty line back.
+ */
+
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/cache_flush.h"
+#include "../util/hugepage.h"
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Enter: %s [rounds]\n", prog);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void dirty(void *const *lines, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		*(volatile char *)lines[i] = 1;
+	}
+}
+
+static void flush_per_line(void *const *lines, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		arch_flush(lines[i]);
+		arch_flush_barrier();
+	}
+}
+
+/*
+ * Average time to flush the lines, over rounds
+ */
+static double time_flush(void (*flush)(void *const *, size_t), void *const *lines, size_t n, int rounds)
+{
+	uint64_t total = 0;
+	for (int r = 0; r < rounds; r++) {
+		dirty(lines, n);
+		uint64_t start = now_ns();
+		flush(lines, n);
+		total += now_ns() - start;
+	}
+	return (double)total / rounds;
+}
+
+static void print_result(const char *what, size_t n, double ns)
+{
+	printf("%-9s %9zu lines: %10.1f us, %6.2f ns/line, %6.2f GB/s\n", what, n, ns / 1000, ns / n,
+		   (double)n * CACHE_BLOCK_SIZE / ns);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 2) {
+		usage(argv[0]);
+	}
+	int rounds = argc > 1 ? atoi(argv[1]) : 10;
+	if (rounds <= 0) {
+		usage(argv[0]);
+	}
+
+	void *buffer = hugepage_alloc(BUF_SIZE, HUGEPAGE_SHIFT);
+
+	// Random lines of the pool, like the lines of an eviction set
+	size_t num_lines = BUF_SIZE / CACHE_BLOCK_SIZE;
+	std::vector<void *> lines(num_lines);
+	for (size_t i = 0; i < num_lines; i++) {
+		lines[i] = (char *)buffer + i * CACHE_BLOCK_SIZE;
+	}
+	std::shuffle(lines.begin(), lines.end(), std::mt19937_64(1));
+
+	for (size_t n : {24UL, 256UL, 4096UL, 65536UL, num_lines}) {
+		// Small sets are repeated more to average out the timer
+		int r = std::max<size_t>(rounds, rounds * 4096 / n);
+		print_result("per-line", n, time_flush(flush_per_line, lines.data(), n, r));
+		print_result("batched", n, time_flush(cache_flush_lines, lines.data(), n, r));
+	}
+
+	// The whole pool as one range
+	double total = 0;
+	for (int r = 0; r < rounds; r++) {
+		memset(buffer, 1, BUF_SIZE);
+		uint64_t start = now_ns();
+		cache_flush_range(buffer, BUF_SIZE);
+		total += now_ns() - start;
+	}
+	print_result("range", num_lines, total / rounds);
+
+	hugepage_free(buffer, BUF_SIZE, HUGEPAGE_SHIFT);
+	return 0;
+}
@@ -0,0 +1,477 @@
+/**
+ * slice-hash-recovery.cpp
+ *
+ * Recovers the physical address -> LLC slice hash of this machine from
+ * timing-based slice measurements and emits a constant-time lookup header.
+ *
+ * The hash is assumed to have the shape of the one reverse-engineered for
+ * the Intel part (util/skx_hash_utils.c):
+ *
+ *   slice = BASE_SEQ[index ^ n(high)]
+ *
+ * where index are the K line address bits above the line offset, high are
+ * the bits above them, BASE_SEQ is an arbitrary (possibly non-linear)
+ * sequence of 2^K slices and n is linear over GF(2).
+ *
+ * n is only determined up to the symmetries of BASE_SEQ, the masks S with
+ * BASE_SEQ[x ^ S] == BASE_SEQ[x] for every x. A purely linear hash has many
+ * (every S in the kernel of the index -> slice map, at least 2^(K - 6) with
+ * 64 slices), so the masks are compared modulo the group of the symmetries.
+ *
+ * Two steps:
+ *   sample: probes every line of a reference region (to learn BASE_SEQ) and
+ *           a few random lines of every other region of a hugepage buffer,
+ *           and writes the (physical address, slice) pairs to a file.
+ *   solve:  finds, for each region, the XOR of the index that maps BASE_SEQ
+ *           onto the samples, solves n by Gaussian elimination, checks the
+ *           result on held-out samples, and writes the header if the base
+ *           sequence is complete and the hash fits.
+ */
+
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/slice_cache.h"
+#include "../util/slice_classifier.h"
+#include "../util/hugepage.h"
+#include <string.h>
+#include <map>
+#include <vector>
+
+#define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+
+// Highest physical address bit considered by the hash
+#define MAX_PHYS_ADDR_BITS 48
+
+// Fraction of the samples (in percent) held out for validation
+#define HOLDOUT_PERCENT 20
+
+// Held-out accuracy below which no header is written
+#define MIN_ACCURACY 0.99
+
+#define UNKNOWN_SLICE 0xFF
+
+struct sample {
+	uint64_t pa;
+	uint8_t slice;
+};
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Enter: %s sample <samples_file> [index_bits] [lines_per_region]\n", prog);
+	fprintf(stderr, "       %s solve <samples_file> <output_header> [index_bits]\n", prog);
+	exit(1);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sampling
+//////////////////////////////////////////////////////////////////////
+
+static int sample_main(const char *samples_fn, int index_bits, int lines_per_region)
+{
+	uint64_t region_size = 1UL << (index_bits + CACHE_BLOCK_SIZE_LOG);
+	uint64_t lines_per_full_region = 1UL << index_bits;
+
+	FILE *output_file = fopen(samples_fn, "w");
+	if (output_file == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	// Allocate large buffer (pool of addresses)
+	void *buffer = hugepage_alloc(BUF_SIZE, HUGEPAGE_SHIFT);
+
+	// The reference region has to be physically contiguous
+	int page_shift = hugepage_shift(HUGEPAGE_SHIFT);
+	if (index_bits + CACHE_BLOCK_SIZE_LOG > page_shift) {
+		fprintf(stderr, "index_bits too large: a region of %" PRIu64 " bytes does not fit in a hugepage\n", region_size);
+		exit(1);
+	}
+
+	uint64_t n_regions = BUF_SIZE / region_size;
+	srand(0);
+
+	for (uint64_t region = 0; region < n_regions; region++) {
+		uint8_t *base = (uint8_t *)buffer + region * region_size;
+		uint64_t n_lines = region == 0 ? lines_per_full_region : (uint64_t)lines_per_region;
+
+		for (uint64_t i = 0; i < n_lines; i++) {
+			uint64_t line = region == 0 ? i : (uint64_t)rand() % lines_per_full_region;
+			void *va = base + line * CACHE_BLOCK_SIZE;
+			uint64_t pa = get_physical_address(va);
+			uint64_t slice = get_cache_slice_index(va);
+			fprintf(output_file, "0x%" PRIx64 " %" PRIu64 "\n", pa, slice);
+		}
+
+		printf("\rregion %4" PRIu64 "/%" PRIu64, region + 1, n_regions);
+		fflush(stdout);
+	}
+	printf("\n");
+
+	slice_cache_print_stats();
+	slice_classifier_print_stats();
+
+	hugepage_free(buffer, BUF_SIZE, HUGEPAGE_SHIFT);
+	fclose(output_file);
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Solving
+//////////////////////////////////////////////////////////////////////
+
+static std::vector<struct sample> read_samples(const char *samples_fn)
+{
+	FILE *f = fopen(samples_fn, "r");
+	if (f == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	std::vector<struct sample> samples;
+	uint64_t pa, slice;
+	while (fscanf(f, "%" SCNx64 " %" SCNu64, &pa, &slice) == 2) {
+		if (pa != 0 && slice < UNKNOWN_SLICE) {
+			samples.push_back({pa, (uint8_t)slice});
+		}
+	}
+	fclose(f);
+	return samples;
+}
+
+/*
+ * Reduces a mask modulo the group spanned by the basis (one vector per
+ * highest bit, 0 if none): the result has none of the highest bits set,
+ * and is the same for all the masks of a coset
+ */
+static uint32_t reduce_mask(const std::vector<uint32_t> &basis, uint32_t mask)
+{
+	for (int bit = basis.size() - 1; bit >= 0; bit--) {
+		if ((mask >> bit) & 1) {
+			mask ^= basis[bit];
+		}
+	}
+	return mask;
+}
+
+/*
+ * Basis of the symmetries of base, the masks S such that base[x ^ S] ==
+ * base[x] for every known x. They form a group, so only the masks outside of
+ * the span of the ones found so far are tested.
+ */
+static std::vector<uint32_t> find_symmetries(const std::vector<uint8_t> &base, int index_bits)
+{
+	std::vector<uint32_t> basis(index_bits, 0);
+	for (uint32_t m = 1; m < base.size(); m++) {
+		if (reduce_mask(basis, m) == 0) {
+			continue;
+		}
+		bool symmetric = true;
+		for (uint32_t x = 0; x < base.size() && symmetric; x++) {
+			symmetric = base[x] == UNKNOWN_SLICE || base[x ^ m] == UNKNOWN_SLICE || base[x] == base[x ^ m];
+		}
+		if (!symmetric) {
+			continue;
+		}
+		uint32_t v = reduce_mask(basis, m);
+		basis[31 - __builtin_clz(v)] = v;
+	}
+	return basis;
+}
+
+/*
+ * Returns the masks M, reduced modulo the symmetries of base, such that
+ * base[x ^ M] == slice for all the samples (stops after finding two)
+ */
+static std::vector<uint32_t> find_masks(const std::vector<uint8_t> &base, const std::vector<uint32_t> &symmetries,
+										const std::vector<struct sample> &group, int index_bits)
+{
+	std::vector<uint32_t> masks;
+	uint32_t index_mask = (1U << index_bits) - 1;
+	for (uint32_t m = 0; m <= index_mask && masks.size() < 2; m++) {
+		if (reduce_mask(symmetries, m) != m) {
+			continue;
+		}
+		bool ok = true;
+		for (const struct sample &s : group) {
+			uint8_t expected = base[((s.pa >> CACHE_BLOCK_SIZE_LOG) & index_mask) ^ m];
+			if (expected != UNKNOWN_SLICE && expected != s.slice) {
+				ok = false;
+				break;
+			}
+		}
+		if (ok) {
+			masks.push_back(m);
+		}
+	}
+	return masks;
+}
+
+static int predict(const std::vector<uint8_t> &base, const std::vector<uint32_t> &xor_map, int index_bits, uint64_t pa)
+{
+	int high_shift = index_bits + CACHE_BLOCK_SIZE_LOG;
+	uint32_t index = (pa >> CACHE_BLOCK_SIZE_LOG) & ((1U << index_bits) - 1);
+	uint64_t high = pa >> high_shift;
+	for (size_t bit = 0; bit < xor_map.size(); bit++) {
+		if ((high >> bit) & 1) {
+			index ^= xor_map[bit];
+		}
+	}
+	return base[index];
+}
+
+static void write_header(const char *header_fn, const std::vector<uint8_t> &base, const std::vector<uint32_t> &xor_map,
+						 int index_bits, double accuracy, size_t n_samples)
+{
+	FILE *f = fopen(header_fn, "w");
+	if (f == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	int high_shift = index_bits + CACHE_BLOCK_SIZE_LOG;
+	int high_bytes = (xor_map.size() + 7) / 8;
+
+	fprintf(f, "/**\n * slice_hash.h\n *\n");
+	fprintf(f, " * Constant-time physical address -> LLC slice hash for this machine.\n *\n");
+	fprintf(f, " * Generated by tools/slice-hash-recovery from %zu samples\n", n_samples);
+	fprintf(f, " * (%.2f%% accuracy on held-out samples). Do not edit.\n */\n\n", accuracy * 100);
+	fprintf(f, "#ifndef SLICE_HASH_H_\n#define SLICE_HASH_H_\n\n#include <inttypes.h>\n\n");
+	fprintf(f, "#define SLICE_HASH_RECOVERED 1\n");
+	fprintf(f, "#define SLICE_HASH_INDEX_BITS %d\n", index_bits);
+	fprintf(f, "#define SLICE_HASH_HIGH_SHIFT %d\n", high_shift);
+	fprintf(f, "#define SLICE_HASH_HIGH_BYTES %d\n\n", high_bytes);
+
+	// Per-bit masks, as in skx_hash_utils.c
+	fprintf(f, "static const uint32_t slice_hash_xor_map[%zu] = {", xor_map.size());
+	for (size_t i = 0; i < xor_map.size(); i++) {
+		fprintf(f, "%s0x%x", i ? ", " : "", xor_map[i]);
+	}
+	fprintf(f, "};\n\n");
+
+	// Byte-wise tables: the XOR of the masks of the bits set in each byte value
+	fprintf(f, "static const uint32_t slice_hash_byte_tables[SLICE_HASH_HIGH_BYTES][256] = {\n");
+	for (int b = 0; b < high_bytes; b++) {
+		fprintf(f, "\t{");
+		for (int v = 0; v < 256; v++) {
+			uint32_t m = 0;
+			for (int bit = 0; bit < 8; bit++) {
+				size_t j = b * 8 + bit;
+				if (((v >> bit) & 1) && j < xor_map.size()) {
+					m ^= xor_map[j];
+				}
+			}
+			fprintf(f, "%s0x%x", v ? "," : "", m);
+		}
+		fprintf(f, "},\n");
+	}
+	fprintf(f, "};\n\n");
+
+	fprintf(f, "static const uint8_t slice_hash_base_seq[1 << SLICE_HASH_INDEX_BITS] = {");
+	for (size_t i = 0; i < base.size(); i++) {
+		fprintf(f, "%s%s%d", i ? "," : "", (i % 32) ? "" : "\n\t", base[i]);
+	}
+	fprintf(f, "\n};\n\n");
+
+	fprintf(f, "static inline int get_slice_with_hash(uint64_t physical_address)\n{\n");
+	fprintf(f, "\tuint64_t high = physical_address >> SLICE_HASH_HIGH_SHIFT;\n");
+	fprintf(f, "\tuint32_t index = (physical_address >> 6) & ((1U << SLICE_HASH_INDEX_BITS) - 1);\n");
+	fprintf(f, "\tfor (int b = 0; b < SLICE_HASH_HIGH_BYTES; b++) {\n");
+	fprintf(f, "\t\tindex ^= slice_hash_byte_tables[b][(high >> (8 * b)) & 0xff];\n");
+	fprintf(f, "\t}\n");
+	fprintf(f, "\treturn slice_hash_base_seq[index];\n}\n\n");
+	fprintf(f, "#endif // SLICE_HASH_H_\n");
+
+	fclose(f);
+}
+
+static int solve_main(const char *samples_fn, const char *header_fn, int index_bits)
+{
+	int high_shift = index_bits + CACHE_BLOCK_SIZE_LOG;
+	int n_high_bits = MAX_PHYS_ADDR_BITS - high_shift;
+	uint32_t index_mask = (1U << index_bits) - 1;
+
+	std::vector<struct sample> samples = read_samples(samples_fn);
+	if (samples.empty()) {
+		fprintf(stderr, "No samples in %s\n", samples_fn);
+		exit(1);
+	}
+
+	// Group the samples by their high bits
+	std::map<uint64_t, std::vector<struct sample>> groups;
+	for (const struct sample &s : samples) {
+		groups[s.pa >> high_shift].push_back(s);
+	}
+
+	// The reference region is the one with the best coverage of the index
+	uint64_t ref_high = 0;
+	size_t ref_coverage = 0;
+	std::vector<uint8_t> base;
+	for (const auto &g : groups) {
+		std::vector<uint8_t> seq(1U << index_bits, UNKNOWN_SLICE);
+		size_t coverage = 0;
+		for (const struct sample &s : g.second) {
+			uint8_t &entry = seq[(s.pa >> CACHE_BLOCK_SIZE_LOG) & index_mask];
+			coverage += entry == UNKNOWN_SLICE;
+			entry = s.slice;
+		}
+		if (coverage > ref_coverage) {
+			ref_coverage = coverage;
+			ref_high = g.first;
+			base = seq;
+		}
+	}
+
+	// Hold out a deterministic subset of the other regions' samples for validation
+	std::vector<struct sample> holdout;
+	srand(1);
+	for (auto &g : groups) {
+		if (g.first == ref_high) {
+			continue;
+		}
+		std::vector<struct sample> train;
+		for (const struct sample &s : g.second) {
+			(rand() % 100 < HOLDOUT_PERCENT ? holdout : train).push_back(s);
+		}
+		g.second = train;
+	}
+
+	printf("Reference region 0x%" PRIx64 ": %zu/%u lines known\n", ref_high << high_shift, ref_coverage, 1U << index_bits);
+
+	std::vector<uint32_t> symmetries = find_symmetries(base, index_bits);
+	int n_symmetries = 0;
+	for (uint32_t v : symmetries) {
+		n_symmetries += v != 0;
+	}
+	printf("Base sequence symmetries: 2^%d\n", n_symmetries);
+
+	// pivots[bit] = (high bits difference, index mask) with bit as its highest set bit
+	std::vector<std::pair<uint64_t, uint32_t>> pivots(n_high_bits, {0, 0});
+	int ambiguous = 0, unmatched = 0, inconsistent = 0, equations = 0;
+
+	for (const auto &g : groups) {
+		if (g.first == ref_high) {
+			continue;
+		}
+		std::vector<uint32_t> masks = find_masks(base, symmetries, g.second, index_bits);
+		if (masks.size() != 1) {
+			masks.empty() ? unmatched++ : ambiguous++;
+			continue;
+		}
+
+		// Insert the equation n(diff) = mask
+		uint64_t diff = g.first ^ ref_high;
+		uint32_t mask = masks[0];
+		equations++;
+		for (int bit = n_high_bits - 1; bit >= 0 && diff != 0; bit--) {
+			if (!((diff >> bit) & 1)) {
+				continue;
+			}
+			if (pivots[bit].first == 0) {
+				pivots[bit] = {diff, mask};
+				break;
+			}
+			diff ^= pivots[bit].first;
+			mask = reduce_mask(symmetries, mask ^ pivots[bit].second);
+		}
+		if (diff == 0 && mask != 0) {
+			// This equation contradicts the previous ones: n is not linear
+			inconsistent++;
+		}
+	}
+
+	// Back-substitution: the mask of each high bit (0 if undetermined)
+	std::vector<uint32_t> xor_map(n_high_bits, 0);
+	std::vector<int> undetermined;
+	for (int bit = 0; bit < n_high_bits; bit++) {
+		if (pivots[bit].first == 0) {
+			undetermined.push_back(bit + high_shift);
+			continue;
+		}
+		uint32_t mask = pivots[bit].second;
+		for (int lower = 0; lower < bit; lower++) {
+			if ((pivots[bit].first >> lower) & 1) {
+				mask ^= xor_map[lower];
+			}
+		}
+		xor_map[bit] = reduce_mask(symmetries, mask);
+	}
+
+	// Relative to the reference region: slice = base[index ^ n(high ^ ref_high)].
+	// n is linear, so fold n(ref_high) into the base sequence.
+	uint32_t ref_mask = 0;
+	for (int bit = 0; bit < n_high_bits; bit++) {
+		if ((ref_high >> bit) & 1) {
+			ref_mask ^= xor_map[bit];
+		}
+	}
+	std::vector<uint8_t> folded(base.size());
+	for (uint32_t i = 0; i < base.size(); i++) {
+		folded[i] = base[i ^ ref_mask];
+	}
+
+	printf("%d regions solved, %d ambiguous, %d unmatched, %d inconsistent\n", equations, ambiguous, unmatched, inconsistent);
+	if (!undetermined.empty()) {
+		printf("Undetermined address bits (assumed not hashed):");
+		for (int bit : undetermined) {
+			printf(" %d", bit);
+		}
+		printf("\n");
+	}
+
+	// Cross-validation
+	size_t correct = 0, known = 0;
+	for (const struct sample &s : holdout) {
+		int predicted = predict(folded, xor_map, index_bits, s.pa);
+		if (predicted == UNKNOWN_SLICE) {
+			continue;
+		}
+		known++;
+		correct += predicted == s.slice;
+	}
+	double accuracy = known ? (double)correct / known : 0.0;
+	printf("Held-out accuracy: %zu/%zu (%.2f%%)\n", correct, known, accuracy * 100);
+
+	if (inconsistent) {
+		fprintf(stderr, "Warning: %d regions contradict a linear n\n", inconsistent);
+	}
+	if (ref_coverage != base.size()) {
+		fprintf(stderr, "The base sequence is incomplete (%zu/%zu lines known): sample again\n", ref_coverage, base.size());
+		exit(1);
+	}
+	if (equations == 0 || accuracy < MIN_ACCURACY) {
+		fprintf(stderr, "The samples do not fit a linear hash with a %d-bit base sequence, not writing %s\n", index_bits,
+				header_fn);
+		exit(1);
+	}
+
+	write_header(header_fn, folded, xor_map, index_bits, accuracy, samples.size());
+	printf("Wrote %s\n", header_fn);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage(argv[0]);
+	}
+
+	if (strcmp(argv[1], "sample") == 0) {
+		int index_bits = argc > 3 ? atoi(argv[3]) : 14;
+		int lines_per_region = argc > 4 ? atoi(argv[4]) : 64;
+		if (index_bits <= 0 || lines_per_region <= 0) {
+			usage(argv[0]);
+		}
+		return sample_main(argv[2], index_bits, lines_per_region);
+	}
+
+	if (strcmp(argv[1], "solve") == 0 && argc >= 4) {
+		int index_bits = argc > 4 ? atoi(argv[4]) : 14;
+		if (index_bits <= 0 || index_bits > 20) {
+			usage(argv[0]);
+		}
+		return solve_main(argv[2], argv[3], index_bits);
+	}
+
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,314 @@
+/**
+ * timer-benchmark.cpp
+ *
+ * Characterizes the timer backends (the generic timer, and the PMU cycle
+ * counter of perf_timer.h when it is readable from user space) on every
+ * usable core (see get_usable_cpus()), and writes the result as the
+ * key=value file of timer_config.h.
+ *
+ * For each backend and core:
+ *   tick frequency: ticks counted over CLOCK_MONOTONIC_RAW.
+ *   resolution:     smallest nonzero difference between two back-to-back
+ *                   reads; some generic timers step by more than one.
+ *   overhead and jitter: distribution of the difference between two
+ *                   back-to-back serialized reads, i.e. the time window of
+ *                   the receivers with nothing in it.
+ *   load latency:   median window of 1 to MAX_LOADS dependent loads that
+ *                   hit the LLC (a random chain over a buffer larger than
+ *                   the L2). The smallest number of loads that moves the
+ *                   median by one resolution step is what a sample needs
+ *                   to tell anything at all.
+ *
+ * The summary keys of a backend are taken over all cores: the slowest
+ * overhead and the largest number of loads to resolve.
+ */
+
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/cpu_topology.h"
+#include "../util/perf_timer.h"
+#include "../util/timer_config.h"
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CALIBRATION_NS 20000000		// 20 ms
+#define CHASE_SIZE (4 * L2_CACHE_SIZE)
+#define MAX_LOADS 64
+
+struct core_result {
+	int core;
+	double tick_ghz;
+	uint64_t resolution;
+	uint64_t overhead_min, overhead_p50, overhead_p90, overhead_p99, overhead_p999, overhead_max;
+	double overhead_mean, overhead_stddev;
+	uint64_t load_p50[MAX_LOADS + 1];	// median window of n loads, by n (powers of two)
+	int min_resolvable_loads;
+	double load_ns;
+};
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Enter: %s <output_file> [samples]\n", prog);
+	exit(1);
+}
+
+ARCH_INLINE uint64_t generic_read(void)
+{
+	return arch_timestamp();
+}
+
+ARCH_INLINE uint64_t generic_read_serial(void)
+{
+	return arch_timestamp_serial();
+}
+
+ARCH_INLINE uint64_t pmu_read(void)
+{
+	return perf_timer_read();
+}
+
+ARCH_INLINE uint64_t pmu_read_serial(void)
+{
+	return perf_timer_read_serial();
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+/*
+ * Links the lines of a buffer into one random cycle. Returns its start.
+ */
+static void **build_chase(void *buffer, size_t size)
+{
+	size_t n = size / CACHE_BLOCK_SIZE;
+	std::vector<size_t> order(n);
+	for (size_t i = 0; i < n; i++) {
+		order[i] = i;
+	}
+	std::shuffle(order.begin() + 1, order.end(), std::mt19937_64(1));
+
+	char *base = (char *)buffer;
+	for (size_t i = 0; i < n; i++) {
+		*(void **)(base + order[i] * CACHE_BLOCK_SIZE) = base + order[(i + 1) % n] * CACHE_BLOCK_SIZE;
+	}
+	return (void **)base;
+}
+
+template <uint64_t (*READ)(void), uint64_t (*READ_SERIAL)(void)>
+static struct core_result measure_core(int core, void **chase, int samples)
+{
+	struct core_result r = {};
+	r.core = core;
+
+	// Tick frequency
+	uint64_t ns0 = now_ns(), t0 = READ_SERIAL(), ns1;
+	do {
+		ns1 = now_ns();
+	} while (ns1 - ns0 < CALIBRATION_NS);
+	r.tick_ghz = (double)(READ_SERIAL() - t0) / (ns1 - ns0);
+
+	// Resolution
+	r.resolution = UINT64_MAX;
+	for (int i = 0; i < samples; i++) {
+		uint64_t a = READ();
+		uint64_t b = READ();
+		if (b > a) {
+			r.resolution = std::min(r.resolution, b - a);
+		}
+	}
+
+	// Overhead and jitter
+	std::vector<uint64_t> deltas(samples);
+	for (int i = 0; i < samples; i++) {
+		uint64_t start = READ_SERIAL();
+		deltas[i] = READ_SERIAL() - start;
+	}
+	std::sort(deltas.begin(), deltas.end());
+	double sum = 0, sumsq = 0;
+	for (uint64_t d : deltas) {
+		sum += d;
+		sumsq += (double)d * d;
+	}
+	r.overhead_mean = sum / samples;
+	r.overhead_stddev = sqrt(std::max(0.0, sumsq / samples - r.overhead_mean * r.overhead_mean));
+	r.overhead_min = deltas.front();
+	r.overhead_p50 = percentile(deltas, 0.5);
+	r.overhead_p90 = percentile(deltas, 0.9);
+	r.overhead_p99 = percentile(deltas, 0.99);
+	r.overhead_p999 = percentile(deltas, 0.999);
+	r.overhead_max = deltas.back();
+
+	// Load latency; the chain is walked once first so that it is in the LLC
+	void **p = chase;
+	for (size_t i = 0; i < CHASE_SIZE / CACHE_BLOCK_SIZE; i++) {
+		p = arch_load_chain(p);
+	}
+	r.min_resolvable_loads = -1;
+	for (int n = 1; n <= MAX_LOADS; n *= 2) {
+		std::vector<uint64_t> windows(samples);
+		for (int i = 0; i < samples; i++) {
+			uint64_t start = READ_SERIAL();
+			for (int j = 0; j < n; j++) {
+				p = arch_load_chain(p);
+			}
+			windows[i] = READ_SERIAL() - start;
+		}
+		std::nth_element(windows.begin(), windows.begin() + samples / 2, windows.end());
+		r.load_p50[n] = windows[samples / 2];
+		if (r.min_resolvable_loads < 0 && r.load_p50[n] >= r.overhead_p50 + r.resolution) {
+			r.min_resolvable_loads = n;
+		}
+	}
+	r.load_ns = r.load_p50[MAX_LOADS] > r.overhead_p50
+		? (double)(r.load_p50[MAX_LOADS] - r.overhead_p50) / MAX_LOADS / r.tick_ghz
+		: 0;
+	if (r.min_resolvable_loads < 0) {
+		r.min_resolvable_loads = MAX_LOADS;
+	}
+	return r;
+}
+
+/*
+ * Measures each of the cores in turn, from a thread pinned to it
+ */
+static std::vector<struct core_result> measure_backend(bool pmu, const std::vector<int> &cores, int samples)
+{
+	void *buffer = mmap(NULL, CHASE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (buffer == MAP_FAILED) {
+		// Without hugepages the chain also misses in the TLB; still better than nothing
+		buffer = mmap(NULL, CHASE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+		if (buffer == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+	}
+	void **chase = build_chase(buffer, CHASE_SIZE);
+
+	std::vector<struct core_result> results;
+	for (size_t i = 0; i < cores.size(); i++) {
+		int core = cores[i];
+		bool ok = true;
+		struct core_result r;
+		std::thread t([&]() {
+			pin_cpu(core);
+			if (pmu) {
+				ok = perf_timer_open();
+				if (ok) {
+					r = measure_core<pmu_read, pmu_read_serial>(core, chase, samples);
+					perf_timer_close();
+				}
+			} else {
+				r = measure_core<generic_read, generic_read_serial>(core, chase, samples);
+			}
+		});
+		t.join();
+		if (!ok) {
+			break;
+		}
+		results.push_back(r);
+		fprintf(stderr, "\r%s: core %zu/%zu", pmu ? "pmu" : "generic", i + 1, cores.size());
+	}
+	fprintf(stderr, "\n");
+
+	munmap(buffer, CHASE_SIZE);
+	return results;
+}
+
+static void print_backend(FILE *f, const char *name, const std::vector<struct core_result> &results)
+{
+	double tick_ghz = 0, load_ns = 0;
+	uint64_t resolution = 0, overhead = 0;
+	int min_loads = 0;
+	for (const struct core_result &r : results) {
+		tick_ghz += r.tick_ghz / results.size();
+		load_ns += r.load_ns / results.size();
+		resolution = std::max(resolution, r.resolution);
+		overhead = std::max(overhead, r.overhead_p50);
+		min_loads = std::max(min_loads, r.min_resolvable_loads);
+	}
+
+	fprintf(f, "%s.tick_ghz=%.6f\n", name, tick_ghz);
+	fprintf(f, "%s.resolution_ticks=%" PRIu64 "\n", name, resolution);
+	fprintf(f, "%s.overhead_ticks=%" PRIu64 "\n", name, overhead);
+	fprintf(f, "%s.min_resolvable_loads=%d\n", name, min_loads);
+	fprintf(f, "%s.load_ns=%.2f\n", name, load_ns);
+
+	for (const struct core_result &r : results) {
+		std::string prefix = std::string(name) + ".core" + std::to_string(r.core) + ".";
+		const char *p = prefix.c_str();
+		fprintf(f, "%stick_ghz=%.6f\n", p, r.tick_ghz);
+		fprintf(f, "%sresolution_ticks=%" PRIu64 "\n", p, r.resolution);
+		fprintf(f, "%soverhead_min=%" PRIu64 "\n", p, r.overhead_min);
+		fprintf(f, "%soverhead_p50=%" PRIu64 "\n", p, r.overhead_p50);
+		fprintf(f, "%soverhead_p90=%" PRIu64 "\n", p, r.overhead_p90);
+		fprintf(f, "%soverhead_p99=%" PRIu64 "\n", p, r.overhead_p99);
+		fprintf(f, "%soverhead_p999=%" PRIu64 "\n", p, r.overhead_p999);
+		fprintf(f, "%soverhead_max=%" PRIu64 "\n", p, r.overhead_max);
+		fprintf(f, "%soverhead_mean=%.3f\n", p, r.overhead_mean);
+		fprintf(f, "%soverhead_stddev=%.3f\n", p, r.overhead_stddev);
+		for (int n = 1; n <= MAX_LOADS; n *= 2) {
+			fprintf(f, "%sloads%d_p50=%" PRIu64 "\n", p, n, r.load_p50[n]);
+		}
+		fprintf(f, "%smin_resolvable_loads=%d\n", p, r.min_resolvable_loads);
+		fprintf(f, "%sload_ns=%.2f\n", p, r.load_ns);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 3) {
+		usage(argv[0]);
+	}
+	int samples = argc > 2 ? atoi(argv[2]) : 100000;
+	if (samples <= 0) {
+		usage(argv[0]);
+	}
+	std::vector<int> cores = get_usable_cpus();
+
+	std::vector<struct core_result> generic = measure_backend(false, cores, samples);
+	std::vector<struct core_result> pmu = measure_backend(true, cores, samples);
+	if (pmu.size() != cores.size()) {
+		fprintf(stderr, "PMU cycle counter not available on every core, skipping it\n");
+		pmu.clear();
+	}
+
+	FILE *f = fopen(argv[1], "w");
+	if (f == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	fprintf(f, "# Generated by tools/timer-benchmark (%d samples per measurement). Do not edit.\n", samples);
+	fprintf(f, "backends=generic%s\n", pmu.empty() ? "" : " pmu");
+	print_backend(f, "generic", generic);
+	if (!pmu.empty()) {
+		print_backend(f, "pmu", pmu);
+	}
+	fclose(f);
+
+	for (const auto *results : {&generic, &pmu}) {
+		for (const struct core_result &r : *results) {
+			printf("%-7s core %3d: %.3f GHz, resolution %" PRIu64 ", overhead p50 %" PRIu64 " p99 %" PRIu64
+				   " max %" PRIu64 ", %d load(s) to resolve, %.1f ns/load\n",
+				   results == &generic ? "generic" : "pmu", r.core, r.tick_ghz, r.resolution, r.overhead_p50,
+				   r.overhead_p99, r.overhead_max, r.min_resolvable_loads, r.load_ns);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,419 @@
+/**
+ * topology-discovery.cpp
+ *
+ * Recovers the mesh layout of this machine from the core-to-slice latency
+ * matrix and emits the C header used by the experiments (cha_id_to_cpu,
+ * NUM_CHA and the die layout) and the DIE_LAYOUT of the Python scripts.
+ *
+ * As everywhere else, a slice is identified by the probe core of the pair
+ * closest to it (see find_closest_slice in util.cpp), so CHA IDs are CPU
+ * numbers and every slice has a core on its tile.
+ *
+ * Three steps:
+ *   measure: times loads from every probe pair to a few lines of every
+ *            slice with the probe loop of slice_probe.h, one pair at a
+ *            time so that no other traffic crosses the mesh being
+ *            measured. Each entry is the minimum over lines and repeats,
+ *            which filters out the remaining interference.
+ *   infer:   maps every slice to the probe CPU that reaches it fastest,
+ *            the one on its tile; turns latencies into hop counts (the
+ *            unit is the median latency step to the nearest other tile),
+ *            picks two adjacent corners of the mesh from the hop counts,
+ *            and places every tile from its distance to both, assuming
+ *            Manhattan routing.
+ *   emit:    writes the header and the config.py fragment.
+ *
+ * The layout is recovered up to a rotation or a reflection of the die.
+ */
+
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/slice_index.h"
+#include "../util/slice_probe.h"
+#include "../util/slice_cache.h"
+#include "../util/slice_classifier.h"
+#include "../util/hugepage.h"
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+
+// Latency differences below this fraction of the local latency are noise
+#define NOISE_FRACTION 0.02
+
+struct tile {
+	int slice;
+	int x;
+	int y;
+};
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Enter: %s <output_header> <output_config_fragment> [lines_per_slice] [repeat]\n", prog);
+	exit(1);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Measurement
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * Latency (ticks per load) from the probe core of each pair to each slice.
+ * Row i is pairs[i], column j is the slice of pairs[j].
+ */
+static std::vector<std::vector<double>> measure_matrix(const std::vector<SliceProbePool::Pair> &pairs,
+													   const std::vector<std::vector<void *>> &lines, uint64_t repeat)
+{
+	size_t n = pairs.size();
+	std::vector<std::vector<double>> lat(n, std::vector<double>(n, INFINITY));
+
+	// A single pool, whose measurements never overlap
+	SliceProbePool pool(pairs);
+	for (size_t i = 0; i < n; i++) {
+		for (size_t s = 0; s < n; s++) {
+			for (void *va : lines[s]) {
+				double t = (double)pool.run(i, va, repeat) / repeat;
+				lat[i][s] = std::min(lat[i][s], t);
+			}
+		}
+		printf("\rprobe cpu %4d (%zu/%zu)", pairs[i].probe_cpu, i + 1, n);
+		fflush(stdout);
+	}
+	printf("\n");
+	return lat;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Inference
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * CPU to pin to for each slice: the probe CPU with the lowest latency to it,
+ * which shares its tile. Slices are named after the probe CPU that found
+ * them closest when they were classified; a slice that another CPU now
+ * reaches faster is reported.
+ */
+static std::vector<int> slice_cpus(const std::vector<std::vector<double>> &lat, const std::vector<int> &slices)
+{
+	size_t n = lat.size();
+	std::vector<int> cpus(n);
+	for (size_t j = 0; j < n; j++) {
+		size_t best = j;
+		for (size_t i = 0; i < n; i++) {
+			if (lat[i][j] < lat[best][j]) {
+				best = i;
+			}
+		}
+		cpus[j] = slices[best];
+		if (best != j) {
+			printf("Slice %d is closest to cpu %d (%.2f ticks per load, %.2f from cpu %d)\n", slices[j], slices[best],
+				   lat[best][j], lat[j][j], slices[j]);
+		}
+	}
+	return cpus;
+}
+
+static double median(std::vector<double> v)
+{
+	std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+	return v[v.size() / 2];
+}
+
+/*
+ * Hop counts between the tiles of the measured slices
+ */
+static std::vector<std::vector<int>> hop_matrix(const std::vector<std::vector<double>> &lat, double *hop_latency)
+{
+	size_t n = lat.size();
+
+	// Symmetric latency above the local one
+	std::vector<std::vector<double>> extra(n, std::vector<double>(n, 0));
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = 0; j < n; j++) {
+			double d = (lat[i][j] + lat[j][i]) / 2 - (lat[i][i] + lat[j][j]) / 2;
+			extra[i][j] = std::max(d, 0.0);
+		}
+	}
+
+	// One hop is the typical step to the nearest other tile
+	std::vector<double> nearest;
+	for (size_t i = 0; i < n; i++) {
+		double best = INFINITY;
+		for (size_t j = 0; j < n; j++) {
+			if (j != i && extra[i][j] > NOISE_FRACTION * lat[i][i]) {
+				best = std::min(best, extra[i][j]);
+			}
+		}
+		if (best < INFINITY) {
+			nearest.push_back(best);
+		}
+	}
+	*hop_latency = nearest.empty() ? 1 : median(nearest);
+
+	std::vector<std::vector<int>> hops(n, std::vector<int>(n, 0));
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = 0; j < n; j++) {
+			hops[i][j] = (int)lround(extra[i][j] / *hop_latency);
+		}
+	}
+	return hops;
+}
+
+/*
+ * Places the tiles on a grid. a is a corner (a tile at the largest distance
+ * from any other), b the farthest tile from it, and c another corner, at
+ * less than distance(a, b) from a. With a at (0, 0) and c at (w, 0),
+ * d(a, t) = x + y and d(c, t) = w - x + y.
+ */
+static std::vector<struct tile> place_tiles(const std::vector<std::vector<int>> &hops, const std::vector<int> &slices)
+{
+	size_t n = hops.size();
+	std::vector<int> ecc(n, 0);
+	for (size_t i = 0; i < n; i++) {
+		ecc[i] = *std::max_element(hops[i].begin(), hops[i].end());
+	}
+	int diameter = *std::max_element(ecc.begin(), ecc.end());
+
+	size_t a = std::max_element(ecc.begin(), ecc.end()) - ecc.begin();
+	size_t c = a;
+	for (size_t i = 0; i < n; i++) {
+		// Most eccentric tile off the diagonal through a, farthest from a
+		if (hops[a][i] < diameter && hops[a][i] > 0 &&
+			(c == a || ecc[i] > ecc[c] || (ecc[i] == ecc[c] && hops[a][i] > hops[a][c]))) {
+			c = i;
+		}
+	}
+
+	int w = c == a ? 0 : hops[a][c];
+	std::vector<struct tile> tiles(n);
+	int min_x = 0, min_y = 0;
+	for (size_t i = 0; i < n; i++) {
+		int sum = hops[a][i];
+		int diff = c == a ? 0 : hops[c][i];
+		tiles[i] = {slices[i], (sum - diff + w) / 2, (sum + diff - w) / 2};
+		min_x = std::min(min_x, tiles[i].x);
+		min_y = std::min(min_y, tiles[i].y);
+	}
+	for (struct tile &t : tiles) {
+		t.x -= min_x;
+		t.y -= min_y;
+	}
+	return tiles;
+}
+
+/*
+ * Mean difference, in hops, between the measured distances and the
+ * Manhattan distances of the placed tiles
+ */
+static double fit_error(const std::vector<std::vector<int>> &hops, const std::vector<struct tile> &tiles)
+{
+	double error = 0;
+	size_t n = tiles.size();
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = 0; j < n; j++) {
+			int d = abs(tiles[i].x - tiles[j].x) + abs(tiles[i].y - tiles[j].y);
+			error += abs(hops[i][j] - d);
+		}
+	}
+	return n ? error / (n * n) : 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Output
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * die[y][x] is the slice of the tile at (x, y), -1 if none was found there
+ */
+static std::vector<std::vector<int>> die_layout(const std::vector<struct tile> &tiles)
+{
+	int cols = 0, rows = 0;
+	for (const struct tile &t : tiles) {
+		cols = std::max(cols, t.x + 1);
+		rows = std::max(rows, t.y + 1);
+	}
+
+	std::vector<std::vector<int>> die(rows, std::vector<int>(cols, -1));
+	for (const struct tile &t : tiles) {
+		if (die[t.y][t.x] != -1) {
+			fprintf(stderr, "Slices %d and %d were both placed at (%d,%d); keeping %d\n",
+					die[t.y][t.x], t.slice, t.y, t.x, die[t.y][t.x]);
+			continue;
+		}
+		die[t.y][t.x] = t.slice;
+	}
+	return die;
+}
+
+static void write_header(const char *header_fn, const std::vector<int> &slices, const std::vector<int> &slice_cpu,
+						 const std::vector<std::vector<int>> &die, double error)
+{
+	FILE *f = fopen(header_fn, "w");
+	if (f == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	int num_cha = *std::max_element(slices.begin(), slices.end()) + 1;
+	std::vector<int> cpus(num_cha, -1);
+	for (size_t j = 0; j < slices.size(); j++) {
+		cpus[slices[j]] = slice_cpu[j];
+	}
+
+	fprintf(f, "/**\n * mesh_topology.h\n *\n");
+	fprintf(f, " * Mesh layout of this machine: the CPU to pin to for each CHA (slice) ID\n");
+	fprintf(f, " * (-1 if none, pin with cha_cpu()), and the slice of each tile of the die\n");
+	fprintf(f, " * (-1 if none).\n *\n");
+	fprintf(f, " * Generated by tools/topology-discovery (mean fit error %.2f hops). Do not edit.\n */\n\n", error);
+	fprintf(f, "#ifndef MESH_TOPOLOGY_H_\n#define MESH_TOPOLOGY_H_\n\n");
+	fprintf(f, "#include <stdio.h>\n#include <stdlib.h>\n\n");
+	fprintf(f, "#define MESH_TOPOLOGY_DISCOVERED 1\n");
+	fprintf(f, "#define NUM_CHA %d\n", num_cha);
+	fprintf(f, "#define NUM_CORES_PER_SOCKET %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(f, "#define DIE_ROWS %zu\n", die.size());
+	fprintf(f, "#define DIE_COLS %zu\n\n", die.empty() ? 0 : die[0].size());
+
+	fprintf(f, "static const int cha_id_to_cpu[NUM_CHA] __attribute__((unused)) = {");
+	for (int i = 0; i < num_cha; i++) {
+		fprintf(f, "%s%s%d", i ? "," : "", (i % 16) ? " " : "\n\t", cpus[i]);
+	}
+	fprintf(f, "\n};\n\n");
+
+	// Same as in the placeholder header
+	fprintf(f, "/*\n * CPU to pin to for a CHA ID. The slice IDs need not be contiguous, so exits\n");
+	fprintf(f, " * if the ID has no CPU.\n */\n");
+	fprintf(f, "static inline int cha_cpu(int cha)\n{\n");
+	fprintf(f, "\tif (cha < 0 || cha >= NUM_CHA || cha_id_to_cpu[cha] < 0) {\n");
+	fprintf(f, "\t\tfprintf(stderr, \"CHA ID %%d has no CPU (see util/mesh_topology.h)\\n\", cha);\n");
+	fprintf(f, "\t\texit(1);\n\t}\n");
+	fprintf(f, "\treturn cha_id_to_cpu[cha];\n}\n\n");
+
+	fprintf(f, "static const int die_layout[DIE_ROWS][DIE_COLS] __attribute__((unused)) = {\n");
+	for (const std::vector<int> &row : die) {
+		fprintf(f, "\t{");
+		for (size_t x = 0; x < row.size(); x++) {
+			fprintf(f, "%s%d", x ? ", " : "", row[x]);
+		}
+		fprintf(f, "},\n");
+	}
+	fprintf(f, "};\n\n#endif // MESH_TOPOLOGY_H_\n");
+	fclose(f);
+}
+
+static void write_config(const char *config_fn, const std::vector<int> &slices, const std::vector<std::vector<int>> &die,
+						 double error)
+{
+	FILE *f = fopen(config_fn, "w");
+	if (f == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	fprintf(f, "\"\"\"\nProcessor topology of this machine.\n\n");
+	fprintf(f, "Generated by tools/topology-discovery (mean fit error %.2f hops). Do not edit.\n\"\"\"\n\n", error);
+
+	fprintf(f, "# Slice IDs of the fully active cores\nCORES = [");
+	for (size_t i = 0; i < slices.size(); i++) {
+		fprintf(f, "%s%d", i ? ", " : "", slices[i]);
+	}
+	fprintf(f, "]\n# Slice IDs of the LLC slices\nSLICES = CORES\n\n");
+
+	fprintf(f, "# The physical layout of the slice IDs on the die\n");
+	fprintf(f, "# -1 denotes a tile with no slice ID (IMC or fully-disabled core)\n");
+	fprintf(f, "DIE_LAYOUT = [\n");
+	for (size_t y = 0; y < die.size(); y++) {
+		fprintf(f, "    [");
+		for (size_t x = 0; x < die[y].size(); x++) {
+			fprintf(f, "%s%d", x ? ", " : "", die[y][x]);
+		}
+		fprintf(f, "]%s\n", y + 1 < die.size() ? "," : "");
+	}
+	fprintf(f, "]\n");
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage(argv[0]);
+	}
+	int lines_per_slice = argc > 3 ? atoi(argv[3]) : 4;
+	uint64_t repeat = argc > 4 ? strtoull(argv[4], NULL, 0) : 20000;
+	if (lines_per_slice <= 0 || repeat == 0) {
+		usage(argv[0]);
+	}
+
+	// Allocate large buffer (pool of addresses)
+	void *buffer = hugepage_alloc(BUF_SIZE, HUGEPAGE_SHIFT);
+
+	// Find a few lines on the slice of every probe core, in different classes
+	std::vector<SliceProbePool::Pair> all_pairs = get_default_probe_pairs();
+	std::vector<SliceProbePool::Pair> pairs;
+	std::vector<std::vector<void *>> lines;
+	std::vector<int> slices;
+	struct slice_index *index = slice_index_create(buffer, BUF_SIZE);
+	for (const SliceProbePool::Pair &p : all_pairs) {
+		std::vector<void *> slice_lines;
+		for (uint32_t cls = 0; cls < L2_CACHE_SETS && (int)slice_lines.size() < lines_per_slice; cls++) {
+			void *va = slice_index_pop(index, p.probe_cpu, cls);
+			if (va != NULL) {
+				slice_lines.push_back(va);
+			}
+		}
+		if (slice_lines.empty()) {
+			printf("No line on the slice of cpu %d, skipping it\n", p.probe_cpu);
+			continue;
+		}
+		pairs.push_back(p);
+		lines.push_back(slice_lines);
+		slices.push_back(p.probe_cpu);
+	}
+	slice_index_destroy(index);
+	slice_cache_print_stats();
+	slice_classifier_print_stats();
+
+	if (pairs.size() < 2) {
+		fprintf(stderr, "Found %zu slices, need at least 2\n", pairs.size());
+		exit(1);
+	}
+
+	std::vector<std::vector<double>> lat = measure_matrix(pairs, lines, repeat);
+
+	printf("Latency matrix (ticks per load, rows: probe cpu, columns: slice)\n     ");
+	for (int s : slices) {
+		printf(" %6d", s);
+	}
+	printf("\n");
+	for (size_t i = 0; i < slices.size(); i++) {
+		printf("%4d:", slices[i]);
+		for (size_t j = 0; j < slices.size(); j++) {
+			printf(" %6.2f", lat[i][j]);
+		}
+		printf("\n");
+	}
+
+	std::vector<int> slice_cpu = slice_cpus(lat, slices);
+	double hop_latency;
+	std::vector<std::vector<int>> hops = hop_matrix(lat, &hop_latency);
+	std::vector<struct tile> tiles = place_tiles(hops, slices);
+	double error = fit_error(hops, tiles);
+	std::vector<std::vector<int>> die = die_layout(tiles);
+
+	printf("One hop: %.2f ticks per load, mean fit error: %.2f hops\n", hop_latency, error);
+	for (const std::vector<int> &row : die) {
+		for (int s : row) {
+			printf(" %3d", s);
+		}
+		printf("\n");
+	}
+
+	write_header(argv[1], slices, slice_cpu, die, error);
+	write_config(argv[2], slices, die, error);
+	printf("Wrote %s and %s\n", argv[1], argv[2]);
+
+	hugepage_free(buffer, BUF_SIZE, HUGEPAGE_SHIFT);
+	return 0;
+}
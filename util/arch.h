@@ -0,0 +1,135 @@
+/**
+ * arch.h
+ *
+ * Timing, load, fence and flush primitives, with one backend per
+ * architecture selected at compile time (aarch64 and x86-64).
+ *
+ * Everything is force-inlined, so that the hot loops of the experiments
+ * compile to the same instruction sequences as the hand-written asm they
+ * replace:
+ *
+ *                          aarch64               x86-64
+ *   arch_timestamp         mrs cntvct_el0        rdtsc
+ *   arch_timestamp_serial  isb; mrs; isb         lfence; rdtsc; lfence
+ *   arch_load              ldr                   mov
+ *   arch_load_chain        ldr x, [x]            mov (r), r
+ *   arch_fence             dsb ish; isb          lfence
+ *   arch_flush             dc civac              clflush
+ *   arch_flush_barrier     dsb ish               mfence
+ *
+ * arch_timestamp_serial waits for the preceding instructions (including
+ * loads) to complete before reading the counter, and keeps the following
+ * ones from starting before it, so a load between two of them is timed from
+ * issue to completion.
+ *
+ * arch_flush does not wait for the flush to complete; a batch of flushes
+ * is completed (and ordered before later accesses) by one
+ * arch_flush_barrier.
+ */
+
+#ifndef ARCH_H_
+#define ARCH_H_
+
+#include <inttypes.h>
+
+#define ARCH_INLINE static inline __attribute__((always_inline))
+
+#if defined(__aarch64__)
+
+ARCH_INLINE uint64_t arch_timestamp(void)
+{
+	uint64_t t;
+	asm volatile("mrs %0, cntvct_el0" : "=r"(t));
+	return t;
+}
+
+ARCH_INLINE uint64_t arch_timestamp_serial(void)
+{
+	uint64_t t;
+	asm volatile(
+		"isb\n\t"
+		"mrs %0, cntvct_el0\n\t"
+		"isb"
+		: "=r"(t)::"memory");
+	return t;
+}
+
+ARCH_INLINE void arch_load(void *p)
+{
+	asm volatile("ldr x0, [%0]" ::"r"(p) : "x0");
+}
+
+ARCH_INLINE void **arch_load_chain(void **p)
+{
+	asm volatile("ldr %0, [%0]" : "+r"(p)::"memory");
+	return p;
+}
+
+ARCH_INLINE void arch_fence(void)
+{
+	asm volatile(
+		"dsb ish\n\t"
+		"isb" ::: "memory");
+}
+
+ARCH_INLINE void arch_flush(void *p)
+{
+	asm volatile("dc civac, %0" ::"r"(p) : "memory");
+}
+
+ARCH_INLINE void arch_flush_barrier(void)
+{
+	asm volatile("dsb ish" ::: "memory");
+}
+
+#elif defined(__x86_64__)
+
+ARCH_INLINE uint64_t arch_timestamp(void)
+{
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+ARCH_INLINE uint64_t arch_timestamp_serial(void)
+{
+	uint32_t lo, hi;
+	asm volatile(
+		"lfence\n\t"
+		"rdtsc\n\t"
+		"lfence"
+		: "=a"(lo), "=d"(hi)::"memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+ARCH_INLINE void arch_load(void *p)
+{
+	asm volatile("movq (%0), %%rax" ::"r"(p) : "rax");
+}
+
+ARCH_INLINE void **arch_load_chain(void **p)
+{
+	asm volatile("movq (%0), %0" : "+r"(p)::"memory");
+	return p;
+}
+
+ARCH_INLINE void arch_fence(void)
+{
+	asm volatile("lfence" ::: "memory");
+}
+
+ARCH_INLINE void arch_flush(void *p)
+{
+	asm volatile("clflush (%0)" ::"r"(p) : "memory");
+}
+
+ARCH_INLINE void arch_flush_barrier(void)
+{
+	asm volatile("mfence" ::: "memory");
+}
+
+#else
+#error "Unsupported architecture: arch.h has aarch64 and x86-64 backends"
+#endif
+
+#endif // ARCH_H_
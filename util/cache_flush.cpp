@@ -0,0 +1,50 @@
+/**
+ * cache_flush.cpp
+ *
+ * See cache_flush.h.
+ */
+
+#include "cache_flush.h"
+#include "cache_geometry.h"
+
+void cache_flush_lines(void *const *lines, size_t n)
+{
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		arch_flush(lines[i]);
+		arch_flush(lines[i + 1]);
+		arch_flush(lines[i + 2]);
+		arch_flush(lines[i + 3]);
+		arch_flush(lines[i + 4]);
+		arch_flush(lines[i + 5]);
+		arch_flush(lines[i + 6]);
+		arch_flush(lines[i + 7]);
+	}
+	for (; i < n; i++) {
+		arch_flush(lines[i]);
+	}
+	arch_flush_barrier();
+}
+
+void cache_flush_range(void *addr, size_t size)
+{
+	uint64_t line_size = get_cache_geometry()->flush_line_size;
+	uint64_t p = (uint64_t)addr & ~(line_size - 1);
+	uint64_t end = (uint64_t)addr + size;
+
+	uint64_t step = 8 * line_size;
+	for (; p + step <= end; p += step) {
+		arch_flush((void *)p);
+		arch_flush((void *)(p + line_size));
+		arch_flush((void *)(p + 2 * line_size));
+		arch_flush((void *)(p + 3 * line_size));
+		arch_flush((void *)(p + 4 * line_size));
+		arch_flush((void *)(p + 5 * line_size));
+		arch_flush((void *)(p + 6 * line_size));
+		arch_flush((void *)(p + 7 * line_size));
+	}
+	for (; p < end; p += line_size) {
+		arch_flush((void *)p);
+	}
+	arch_flush_barrier();
+}
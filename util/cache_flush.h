@@ -0,0 +1,47 @@
+/**
+ * cache_flush.h
+ *
+ * Batched cache flushes: every line of a batch is cleaned and invalidated
+ * to the point of coherency (DC CIVAC on aarch64, clflush on x86-64) and
+ * the batch is completed by a single barrier, instead of one per line.
+ * The flushes of a batch are independent, so they overlap and a large range
+ * is flushed at close to memory bandwidth.
+ *
+ * When these return, the lines are out of every cache, and later accesses
+ * are ordered after the flushes.
+ */
+
+#ifndef CACHE_FLUSH_H_
+#define CACHE_FLUSH_H_
+
+#include <stddef.h>
+#include "flat_ev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Flushes n lines given by their addresses
+ */
+void cache_flush_lines(void *const *lines, size_t n);
+
+/*
+ * Flushes every line overlapping [addr, addr + size), stepping by the
+ * smallest data cache line size (from CTR_EL0 on aarch64)
+ */
+void cache_flush_range(void *addr, size_t size);
+
+/*
+ * Flushes every line of an eviction or monitoring set
+ */
+static inline void flat_ev_flush(const struct flat_ev *ev)
+{
+	cache_flush_lines(ev->lines, ev->size);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CACHE_FLUSH_H_
@@ -0,0 +1,246 @@
+/**
+ * cache_geometry.cpp
+ *
+ * See cache_geometry.h.
+ */
+
+#include "cache_geometry.h"
+#include "machine_const.h"
+
+#include <array>
+#include <mutex>
+#include <utility>
+
+#define SYSFS_CACHE_DIR "/sys/devices/system/cpu/cpu0/cache"
+#define MAX_SYSFS_INDEX 16
+#define MAX_SETS_LOG 20
+
+static std::once_flag geometry_once;
+static struct cache_geometry geometry;
+static cache_set_index_fn set_index_fns[CACHE_LEVELS + 1];
+
+/*
+ * Set index kernel for lines of 2^LINE_LOG bytes and 2^SETS_LOG sets
+ */
+template <unsigned LINE_LOG, unsigned SETS_LOG>
+static uint64_t set_index_pow2(uint64_t addr)
+{
+	return (addr >> LINE_LOG) & ((1ULL << SETS_LOG) - 1);
+}
+
+/*
+ * Fallback for geometries without a specialized kernel
+ */
+template <int LEVEL>
+static uint64_t set_index_generic(uint64_t addr)
+{
+	return (addr / geometry.level[LEVEL].line_size) % geometry.level[LEVEL].sets;
+}
+
+template <unsigned LINE_LOG, size_t... SETS_LOG>
+static constexpr std::array<cache_set_index_fn, sizeof...(SETS_LOG)> kernel_row(std::index_sequence<SETS_LOG...>)
+{
+	return {{&set_index_pow2<LINE_LOG, SETS_LOG>...}};
+}
+
+// Kernels for 64 B and 128 B lines, indexed by the log of the number of sets
+static constexpr auto kernels_64 = kernel_row<6>(std::make_index_sequence<MAX_SETS_LOG + 1>());
+static constexpr auto kernels_128 = kernel_row<7>(std::make_index_sequence<MAX_SETS_LOG + 1>());
+
+static constexpr cache_set_index_fn generic_kernels[CACHE_LEVELS + 1] = {
+	NULL, &set_index_generic<1>, &set_index_generic<2>, &set_index_generic<3>,
+};
+
+static int log2_exact(uint64_t x)
+{
+	if (x == 0 || (x & (x - 1)) != 0) {
+		return -1;
+	}
+	return __builtin_ctzll(x);
+}
+
+static cache_set_index_fn pick_kernel(int level)
+{
+	int line_log = log2_exact(geometry.level[level].line_size);
+	int sets_log = log2_exact(geometry.level[level].sets);
+	if (sets_log < 0 || sets_log > MAX_SETS_LOG) {
+		return generic_kernels[level];
+	}
+	if (line_log == 6) {
+		return kernels_64[sets_log];
+	}
+	if (line_log == 7) {
+		return kernels_128[sets_log];
+	}
+	return generic_kernels[level];
+}
+
+/*
+ * Reads one unsigned value from a sysfs file. Sizes such as "64K" are fine,
+ * only the number is used.
+ */
+static bool read_sysfs_value(int index, const char *name, uint32_t *value)
+{
+	char path[128];
+	snprintf(path, sizeof(path), SYSFS_CACHE_DIR "/index%d/%s", index, name);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+	bool ok = fscanf(f, "%" SCNu32, value) == 1;
+	fclose(f);
+	return ok;
+}
+
+static bool is_instruction_cache(int index)
+{
+	char path[128], type[32] = "";
+	snprintf(path, sizeof(path), SYSFS_CACHE_DIR "/index%d/type", index);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+	bool ok = fscanf(f, "%31s", type) == 1;
+	fclose(f);
+	return ok && type[0] == 'I';
+}
+
+/*
+ * Smallest data (or instruction) cache line size, from CTR_EL0.DminLine
+ * (IminLine), in log2 of words
+ */
+static uint32_t ctr_line_size(bool instruction)
+{
+#if defined(__aarch64__)
+	uint64_t ctr;
+	asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+	return 4u << ((ctr >> (instruction ? 0 : 16)) & 0xF);
+#else
+	(void)instruction;
+	return 0;
+#endif
+}
+
+static void discover(void)
+{
+	geometry.level[1] = {CACHE_BLOCK_SIZE, L1_CACHE_SETS, L1_CACHE_WAYS, 0};
+	geometry.level[2] = {CACHE_BLOCK_SIZE, L2_CACHE_SETS, L2_CACHE_WAYS, 0};
+	geometry.level[3] = {CACHE_BLOCK_SIZE, LLC_CACHE_SETS_PER_SLICE, LLC_CACHE_WAYS, 0};
+	geometry.llc_slices = LLC_CACHE_SLICES;
+
+	uint32_t line_size = ctr_line_size(false);
+	// Unlike the line sizes, not overridden by sysfs: DC CIVAC is only
+	// guaranteed to cover DminLine bytes
+	geometry.flush_line_size = line_size ? line_size : CACHE_BLOCK_SIZE;
+	if (line_size) {
+		for (int level = 1; level <= CACHE_LEVELS; level++) {
+			geometry.level[level].line_size = line_size;
+		}
+	}
+	geometry.l1i = geometry.level[1];
+	line_size = ctr_line_size(true);
+	if (line_size) {
+		geometry.l1i.line_size = line_size;
+	}
+
+	for (int index = 0; index < MAX_SYSFS_INDEX; index++) {
+		uint32_t level, sets, ways;
+		if (!read_sysfs_value(index, "level", &level)) {
+			break;
+		}
+		if (level < 1 || level > CACHE_LEVELS ||
+			!read_sysfs_value(index, "number_of_sets", &sets) || !read_sysfs_value(index, "ways_of_associativity", &ways) ||
+			sets == 0 || ways == 0) {
+			continue;
+		}
+		if (is_instruction_cache(index)) {
+			if (level == 1) {
+				geometry.l1i.sets = sets;
+				geometry.l1i.ways = ways;
+				read_sysfs_value(index, "coherency_line_size", &geometry.l1i.line_size);
+			}
+			continue;
+		}
+		if (level == CACHE_LEVELS) {
+			if (sets % geometry.llc_slices != 0) {
+				continue;
+			}
+			sets /= geometry.llc_slices;
+		}
+
+		geometry.level[level].sets = sets;
+		geometry.level[level].ways = ways;
+		read_sysfs_value(index, "coherency_line_size", &geometry.level[level].line_size);
+	}
+
+	for (int level = 1; level <= CACHE_LEVELS; level++) {
+		struct cache_level_geometry *g = &geometry.level[level];
+		g->stride = (uint64_t)g->sets * g->line_size;
+		set_index_fns[level] = pick_kernel(level);
+	}
+	geometry.l1i.stride = (uint64_t)geometry.l1i.sets * geometry.l1i.line_size;
+}
+
+const struct cache_geometry *get_cache_geometry(void)
+{
+	std::call_once(geometry_once, discover);
+	return &geometry;
+}
+
+cache_set_index_fn get_cache_set_index_fn(int cache_level)
+{
+	get_cache_geometry();
+	if (cache_level < 1 || cache_level > CACHE_LEVELS) {
+		return NULL;
+	}
+	return set_index_fns[cache_level];
+}
+
+uint64_t get_cache_index_stride(int cache_level)
+{
+	if (cache_level < 1 || cache_level > CACHE_LEVELS) {
+		return 0;
+	}
+	return get_cache_geometry()->level[cache_level].stride;
+}
+
+void print_cache_geometry(FILE *stream)
+{
+	static const struct cache_level_geometry defaults[CACHE_LEVELS + 1] = {
+		{0, 0, 0, 0},
+		{CACHE_BLOCK_SIZE, L1_CACHE_SETS, L1_CACHE_WAYS, 0},
+		{CACHE_BLOCK_SIZE, L2_CACHE_SETS, L2_CACHE_WAYS, 0},
+		{CACHE_BLOCK_SIZE, LLC_CACHE_SETS_PER_SLICE, LLC_CACHE_WAYS, 0},
+	};
+
+	const struct cache_geometry *g = get_cache_geometry();
+	for (int level = 1; level <= CACHE_LEVELS; level++) {
+		const struct cache_level_geometry *l = &g->level[level];
+		bool differs = l->line_size != defaults[level].line_size || l->sets != defaults[level].sets ||
+					   l->ways != defaults[level].ways;
+		fprintf(stream, "L%d%s: %" PRIu32 " sets, %" PRIu32 "-way, %" PRIu32 " B/line, stride 0x%" PRIx64 "%s\n",
+				level, level == CACHE_LEVELS ? " (per slice)" : "", l->sets, l->ways, l->line_size, l->stride,
+				differs ? " (differs from machine_const.h)" : "");
+	}
+	fprintf(stream, "L1i: %" PRIu32 " sets, %" PRIu32 "-way, %" PRIu32 " B/line\n", g->l1i.sets, g->l1i.ways,
+			g->l1i.line_size);
+	fprintf(stream, "LLC slices: %" PRIu32 "\n", g->llc_slices);
+}
+
+void check_cache_geometry(void)
+{
+	static const uint32_t sets[CACHE_LEVELS + 1] = {0, L1_CACHE_SETS, L2_CACHE_SETS, LLC_CACHE_SETS_PER_SLICE};
+
+	const struct cache_geometry *g = get_cache_geometry();
+	for (int level = 1; level <= CACHE_LEVELS; level++) {
+		const struct cache_level_geometry *l = &g->level[level];
+		// Lines congruent in the L2 are congruent in any L1 with as many sets or fewer
+		bool matches = level == 1 ? l->stride <= L2_INDEX_STRIDE : l->sets == sets[level];
+		if (l->line_size != CACHE_BLOCK_SIZE || !matches) {
+			fprintf(stderr, "cache_geometry: the L%d geometry differs from machine_const.h, update it for this machine\n",
+					level);
+			print_cache_geometry(stderr);
+			exit(1);
+		}
+	}
+}
@@ -0,0 +1,80 @@
+/**
+ * cache_geometry.h
+ *
+ * Cache geometry of the machine, discovered at startup.
+ *
+ * level[] describes the data (or unified) caches. The L1 instruction cache,
+ * in l1i, defaults to the geometry of the L1 data cache.
+ *
+ * The values of machine_const.h are the defaults. They are overridden by
+ * the line sizes in CTR_EL0 (readable from user space, unlike CCSIDR_EL1)
+ * and then by the cache description of cpu0 in
+ * /sys/devices/system/cpu/cpu0/cache. The LLC is described per slice: its
+ * sysfs set count is divided by LLC_CACHE_SLICES.
+ *
+ * Set index computations go through one kernel per cache level, picked
+ * once from kernels specialized on the line size and the number of sets,
+ * so computing an index is a shift and a mask with constant operands.
+ */
+
+#ifndef CACHE_GEOMETRY_H_
+#define CACHE_GEOMETRY_H_
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CACHE_LEVELS 3	// L1, L2 and LLC (per slice)
+
+struct cache_level_geometry {
+	uint32_t line_size;
+	uint32_t sets;
+	uint32_t ways;
+	uint64_t stride;	// offset between two addresses with the same set index
+};
+
+struct cache_geometry {
+	struct cache_level_geometry level[CACHE_LEVELS + 1];	// indexed by cache level, level[0] unused
+	struct cache_level_geometry l1i;	// L1 instruction cache
+	uint32_t llc_slices;
+	uint32_t flush_line_size;	// CTR_EL0.DminLine, the step of DC CIVAC (CACHE_BLOCK_SIZE on x86-64)
+};
+
+typedef uint64_t (*cache_set_index_fn)(uint64_t addr);
+
+/*
+ * Discovers the geometry on the first call
+ */
+const struct cache_geometry *get_cache_geometry(void);
+
+/*
+ * Set index kernel of a cache level (1 to CACHE_LEVELS)
+ */
+cache_set_index_fn get_cache_set_index_fn(int cache_level);
+
+/*
+ * Offset to the next address with the same set index in a cache level
+ */
+uint64_t get_cache_index_stride(int cache_level);
+
+/*
+ * Prints the geometry, and whether it differs from machine_const.h
+ */
+void print_cache_geometry(FILE *stream);
+
+/*
+ * Exits, printing the geometry, if the line sizes or the L2 and LLC set
+ * counts differ from the machine_const.h constants that the slice index and
+ * the eviction set code are compiled with, or if the L1 index has bits
+ * above the L2 index. The ways only size the sets, and may differ.
+ */
+void check_cache_geometry(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CACHE_GEOMETRY_H_
@@ -12,4 +12,8 @@
 echo madvise | sudo tee /sys/kernel/mm/transparent_hugepage/enabled
 
 # Unload MSR module
-# sudo modprobe -r msr
\ No newline at end of file
+# sudo modprobe -r msr
+
+# Remove the shared address pool, giving its hugepages back
+sudo rm -f ${HUGETLBFS_DIR:-/dev/hugepages}/dont-mesh-around-pool /dev/shm/dont-mesh-around-pool-index /dev/shm/dont-mesh-around-pool-init
+sudo rm -f ${HUGETLBFS_DIR_1GB:-/dev/hugepages1G}/dont-mesh-around-pool-1g /dev/shm/dont-mesh-around-pool-1g-index /dev/shm/dont-mesh-around-pool-1g-init
@@ -0,0 +1,138 @@
+/**
+ * cpu_topology.cpp
+ *
+ * See cpu_topology.h.
+ */
+
+#include "cpu_topology.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define SYSFS_CPU_DIR "/sys/devices/system/cpu"
+#define MAX_CPU_LIST 4096
+
+std::vector<int> parse_cpu_list(const char *list)
+{
+	std::vector<int> cpus;
+	const char *p = list;
+	while (*p != '\0' && *p != '\n') {
+		char *end;
+		long first = strtol(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		long last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			cpus.push_back(cpu);
+		}
+		p = *end == ',' ? end + 1 : end;
+	}
+	std::sort(cpus.begin(), cpus.end());
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+	return cpus;
+}
+
+std::vector<int> read_cpu_list(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return {};
+	}
+	char list[MAX_CPU_LIST] = "";
+	if (fgets(list, sizeof(list), f) == NULL) {
+		list[0] = '\0';
+	}
+	fclose(f);
+	return parse_cpu_list(list);
+}
+
+static std::vector<int> read_topology_list(int cpu, const char *name)
+{
+	char path[128];
+	snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d/topology/%s", cpu, name);
+	return read_cpu_list(path);
+}
+
+std::vector<int> get_usable_cpus(void)
+{
+	std::vector<int> online = read_cpu_list(SYSFS_CPU_DIR "/online");
+	std::vector<int> isolated = read_cpu_list(SYSFS_CPU_DIR "/isolated");
+
+	// The affinity mask, sized for the highest online CPU
+	int n_cpus = online.empty() ? CPU_SETSIZE : online.back() + 1;
+	cpu_set_t *allowed = CPU_ALLOC(n_cpus);
+	size_t allowed_size = CPU_ALLOC_SIZE(n_cpus);
+	CPU_ZERO_S(allowed_size, allowed);
+	if (sched_getaffinity(0, allowed_size, allowed) != 0) {
+		perror("sched_getaffinity");
+		exit(1);
+	}
+	if (online.empty()) {
+		for (int cpu = 0; cpu < n_cpus; cpu++) {
+			online.push_back(cpu);
+		}
+	}
+
+	std::vector<int> cpus;
+	for (int cpu : online) {
+		if (CPU_ISSET_S(cpu, allowed_size, allowed) && !std::binary_search(isolated.begin(), isolated.end(), cpu)) {
+			cpus.push_back(cpu);
+		}
+	}
+	CPU_FREE(allowed);
+	return cpus;
+}
+
+std::vector<int> get_cpu_group(int cpu)
+{
+	std::vector<int> siblings = read_topology_list(cpu, "thread_siblings_list");
+	if (siblings.size() > 1) {
+		return siblings;
+	}
+	std::vector<int> cluster = read_topology_list(cpu, "cluster_cpus_list");
+	std::vector<int> package = read_topology_list(cpu, "package_cpus_list");
+	if (package.empty()) {
+		package = read_topology_list(cpu, "core_siblings_list");
+	}
+	if (cluster.size() > 1 && cluster.size() < package.size()) {
+		return cluster;
+	}
+	return {cpu};
+}
+
+/*
+ * Reads an integer topology attribute of cpu, -1 if unknown
+ */
+static int read_topology_value(int cpu, const char *name)
+{
+	char path[128];
+	snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d/topology/%s", cpu, name);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+	int value;
+	if (fscanf(f, "%d", &value) != 1) {
+		value = -1;
+	}
+	fclose(f);
+	return value;
+}
+
+int get_cpu_package(int cpu)
+{
+	return read_topology_value(cpu, "physical_package_id");
+}
+
+int get_cpu_cluster(int cpu)
+{
+	return read_topology_value(cpu, "cluster_id");
+}
@@ -0,0 +1,47 @@
+/**
+ * cpu_topology.h
+ *
+ * CPU topology of this machine, read from sysfs
+ * (/sys/devices/system/cpu). CPU sets are vectors of CPU numbers in
+ * increasing order, so they are not limited to 64 (or CPU_SETSIZE) CPUs.
+ */
+
+#ifndef CPU_TOPOLOGY_H_
+#define CPU_TOPOLOGY_H_
+
+#include <vector>
+
+/*
+ * Parses a CPU list such as "0-3,8,10-11"
+ */
+std::vector<int> parse_cpu_list(const char *list);
+
+/*
+ * Reads a CPU list from a sysfs file; empty if the file is missing
+ */
+std::vector<int> read_cpu_list(const char *path);
+
+/*
+ * CPUs this process can be pinned to: online, not isolated (isolcpus),
+ * and in its affinity mask
+ */
+std::vector<int> get_usable_cpus(void);
+
+/*
+ * CPUs of the smallest topology group of cpu that has more than one CPU:
+ * its SMT siblings, else its cluster, if the cluster is smaller than its
+ * package. Contains only cpu if neither exists.
+ */
+std::vector<int> get_cpu_group(int cpu);
+
+/*
+ * Physical package of cpu, -1 if unknown
+ */
+int get_cpu_package(int cpu);
+
+/*
+ * Cluster of cpu within its package, -1 if unknown
+ */
+int get_cpu_cluster(int cpu);
+
+#endif // CPU_TOPOLOGY_H_
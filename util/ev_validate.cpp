@@ -0,0 +1,211 @@
+/**
+ * ev_validate.cpp
+ *
+ * See ev_validate.h. Candidate sets are measured with few trials while they
+ * are being minimized, and the final set of each pattern is measured again
+ * with more trials before the patterns are compared.
+ */
+
+#include "ev_validate.h"
+
+#include <algorithm>
+#include <vector>
+
+#define CALIBRATION_SAMPLES 1000
+#define MINIMIZE_TRIALS 64
+#define REPORT_TRIALS 1000
+
+// Traversals tried by ev_optimize(), the last one is the fallback
+static const struct ev_traversal candidates[] = {
+	{EV_PATTERN_LOAD, 1},
+	{EV_PATTERN_LOAD, 2},
+	{EV_PATTERN_CHASE, 1},
+	{EV_PATTERN_CHASE, 2},
+	{EV_PATTERN_OVERLAPPING, 1},
+	{EV_PATTERN_OVERLAPPING, 2},
+	{EV_PATTERN_OVERLAPPING, 4},
+};
+#define NUM_CANDIDATES (int)(sizeof(candidates) / sizeof(candidates[0]))
+
+static const char *pattern_names[] = {"load", "overlapping", "chase"};
+
+/*
+ * Times one load, the same way the receivers do
+ */
+static inline uint64_t time_load(void *p)
+{
+	uint64_t start = arch_timestamp_serial();
+	arch_load(p);
+	return arch_timestamp_serial() - start;
+}
+
+static uint64_t median(std::vector<uint64_t> &samples)
+{
+	std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+	return samples[samples.size() / 2];
+}
+
+uint64_t ev_calibrate_threshold(const struct flat_ev *targets)
+{
+	size_t scrub_size = 2 * L2_CACHE_SIZE;
+	char *scrub = (char *)aligned_alloc(CACHE_BLOCK_SIZE, scrub_size);
+	if (scrub == NULL) {
+		perror("aligned_alloc");
+		exit(1);
+	}
+	for (size_t off = 0; off < scrub_size; off += CACHE_BLOCK_SIZE) {
+		scrub[off] = 1;
+	}
+
+	std::vector<uint64_t> hits, misses;
+	for (int i = 0; i < CALIBRATION_SAMPLES; i += targets->size) {
+		flat_ev_load(targets);
+		for (int j = 0; j < targets->size; j++) {
+			hits.push_back(time_load(targets->lines[j]));
+		}
+
+		for (size_t off = 0; off < scrub_size; off += CACHE_BLOCK_SIZE) {
+			maccess(scrub + off);
+		}
+		for (int j = 0; j < targets->size; j++) {
+			misses.push_back(time_load(targets->lines[j]));
+		}
+	}
+	free(scrub);
+
+	uint64_t hit = median(hits);
+	uint64_t miss = median(misses);
+	if (miss <= hit + 1) {
+		// The timer cannot tell them apart; anything slower than a hit is a miss
+		return hit;
+	}
+	return (hit + miss) / 2;
+}
+
+double ev_eviction_rate(const struct flat_ev *ev, const struct flat_ev *targets, struct ev_traversal t,
+						uint64_t threshold, int trials, double *cycles)
+{
+	// Bring the set to where it stays in steady state
+	flat_ev_load(targets);
+	ev_traverse(ev, t);
+
+	uint64_t evicted = 0;
+	uint64_t traversal_cycles = 0;
+	for (int i = 0; i < trials; i++) {
+		flat_ev_load(targets);
+
+		uint64_t start = get_time();
+		ev_traverse(ev, t);
+		traversal_cycles += get_time() - start;
+
+		for (int j = 0; j < targets->size; j++) {
+			evicted += time_load(targets->lines[j]) > threshold;
+		}
+	}
+
+	if (cycles) {
+		*cycles = (double)traversal_cycles / trials;
+	}
+	return (double)evicted / ((uint64_t)trials * targets->size);
+}
+
+/*
+ * Eviction rate of a candidate set, linking it first if t chases pointers
+ */
+static double candidate_rate(const std::vector<void *> &lines, const struct flat_ev *targets, struct ev_traversal t,
+							 uint64_t threshold)
+{
+	struct flat_ev *ev = flat_ev_alloc(lines.size());
+	std::copy(lines.begin(), lines.end(), ev->lines);
+	if (t.pattern == EV_PATTERN_CHASE) {
+		flat_ev_link(ev);
+	}
+	double rate = ev_eviction_rate(ev, targets, t, threshold, MINIMIZE_TRIALS, NULL);
+	flat_ev_free(ev);
+	return rate;
+}
+
+struct flat_ev *ev_minimize(const struct flat_ev *ev, const struct flat_ev *targets, struct ev_traversal t,
+							uint64_t threshold, double min_rate)
+{
+	std::vector<void *> lines(ev->lines, ev->lines + ev->size);
+
+	for (size_t chunk = lines.size() / 2; chunk >= 1; chunk /= 2) {
+		size_t start = 0;
+		while (start < lines.size() && lines.size() > chunk) {
+			std::vector<void *> candidate(lines.begin(), lines.begin() + start);
+			candidate.insert(candidate.end(), lines.begin() + std::min(start + chunk, lines.size()), lines.end());
+
+			if (candidate_rate(candidate, targets, t, threshold) >= min_rate) {
+				lines.swap(candidate);
+			} else {
+				start += chunk;
+			}
+		}
+	}
+
+	struct flat_ev *minimal = flat_ev_alloc(lines.size());
+	std::copy(lines.begin(), lines.end(), minimal->lines);
+	return minimal;
+}
+
+/*
+ * Measures ev with traversal t into report
+ */
+static void measure(const struct flat_ev *ev, const struct flat_ev *targets, struct ev_traversal t,
+					uint64_t threshold, struct ev_report *report)
+{
+	if (t.pattern == EV_PATTERN_CHASE) {
+		flat_ev_link(ev);
+	}
+	report->traversal = t;
+	report->size = ev->size;
+	report->threshold = threshold;
+	report->eviction_rate = ev_eviction_rate(ev, targets, t, threshold, REPORT_TRIALS, &report->cycles_per_traversal);
+	report->cycles_per_eviction = report->eviction_rate > 0
+		? report->cycles_per_traversal / report->eviction_rate
+		: report->cycles_per_traversal * REPORT_TRIALS * targets->size;
+}
+
+struct flat_ev *ev_optimize(const struct flat_ev *ev, const struct flat_ev *targets, double min_rate,
+							struct ev_report *report)
+{
+	uint64_t threshold = ev_calibrate_threshold(targets);
+	std::vector<void *> all(ev->lines, ev->lines + ev->size);
+
+	struct flat_ev *best = NULL;
+	for (int c = 0; c < NUM_CANDIDATES; c++) {
+		if (candidate_rate(all, targets, candidates[c], threshold) < min_rate) {
+			continue;
+		}
+
+		struct flat_ev *minimal = ev_minimize(ev, targets, candidates[c], threshold, min_rate);
+		struct ev_report r;
+		measure(minimal, targets, candidates[c], threshold, &r);
+
+		if (r.eviction_rate >= min_rate && (best == NULL || r.cycles_per_eviction < report->cycles_per_eviction)) {
+			flat_ev_free(best);
+			best = minimal;
+			*report = r;
+		} else {
+			flat_ev_free(minimal);
+		}
+	}
+
+	if (best == NULL) {
+		best = flat_ev_alloc(ev->size);
+		std::copy(all.begin(), all.end(), best->lines);
+		measure(best, targets, candidates[NUM_CANDIDATES - 1], threshold, report);
+	} else if (report->traversal.pattern == EV_PATTERN_CHASE) {
+		// The chains of the other candidates went through the same lines
+		flat_ev_link(best);
+	}
+	return best;
+}
+
+void ev_print_report(FILE *stream, const char *name, const struct ev_report *report)
+{
+	fprintf(stream, "%s: %d lines, %s x%d, eviction rate %.3f, %.1f cycles/traversal, %.1f cycles/eviction (threshold %" PRIu64 ")\n",
+			name, report->size, pattern_names[report->traversal.pattern], report->traversal.passes,
+			report->eviction_rate, report->cycles_per_traversal, report->cycles_per_eviction, report->threshold);
+}
@@ -0,0 +1,118 @@
+/**
+ * ev_validate.h
+ *
+ * Validation and minimization of eviction sets.
+ *
+ * An eviction set is validated against the lines it is meant to evict from
+ * the private caches (the targets, e.g. a monitoring set): the targets are
+ * loaded, the set is traversed once, and each target is timed on reload.
+ * A reload slower than the threshold counts as an eviction.
+ *
+ * ev_optimize() tries every traversal pattern below, greedily drops the
+ * lines that are not needed to keep the eviction rate above a minimum, and
+ * keeps the pattern with the lowest cost per eviction:
+ *
+ *   struct ev_report report;
+ *   struct flat_ev *small = ev_optimize(ev, targets, EV_MIN_EVICTION_RATE, &report);
+ *   ev_print_report(stdout, "EV", &report);
+ *   ...
+ *   ev_traverse(small, report.traversal);
+ */
+
+#ifndef EV_VALIDATE_H_
+#define EV_VALIDATE_H_
+
+#include "flat_ev.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default min_rate of the experiments
+#define EV_MIN_EVICTION_RATE 0.95
+
+enum ev_pattern {
+	EV_PATTERN_LOAD,		// flat_ev_load()
+	EV_PATTERN_OVERLAPPING,	// flat_ev_load_overlapping()
+	EV_PATTERN_CHASE,		// flat_ev_chase(), the set must be linked
+};
+
+struct ev_traversal {
+	enum ev_pattern pattern;
+	int passes;
+};
+
+struct ev_report {
+	struct ev_traversal traversal;
+	int size;					// lines left in the set
+	double eviction_rate;		// fraction of the target reloads that missed
+	double cycles_per_traversal;
+	double cycles_per_eviction;	// cycles_per_traversal / eviction_rate
+	uint64_t threshold;			// reload latency above which a target was evicted
+};
+
+/*
+ * Traverses ev once with the given pattern. Chase traversals assume that ev
+ * was linked with flat_ev_link(), which ev_optimize() does when it picks one.
+ */
+static inline void ev_traverse(const struct flat_ev *ev, struct ev_traversal t)
+{
+	switch (t.pattern) {
+	case EV_PATTERN_LOAD:
+		for (int j = 0; j < t.passes; j++) {
+			flat_ev_load(ev);
+		}
+		break;
+	case EV_PATTERN_OVERLAPPING:
+		flat_ev_load_overlapping(ev, t.passes);
+		break;
+	case EV_PATTERN_CHASE:
+		if (ev->size) {
+			flat_ev_chase((void **)ev->lines[0], t.passes * ev->size);
+		}
+		break;
+	}
+}
+
+/*
+ * Picks the reload latency threshold between a private cache hit and a
+ * private cache miss for the targets. The miss latency is measured after
+ * streaming through twice the L2 size, which leaves the targets in the LLC.
+ */
+uint64_t ev_calibrate_threshold(const struct flat_ev *targets);
+
+/*
+ * Fraction of the target reloads slower than threshold after one traversal
+ * of ev, over trials trials. If cycles is not NULL, it receives the average
+ * duration of a traversal.
+ */
+double ev_eviction_rate(const struct flat_ev *ev, const struct flat_ev *targets, struct ev_traversal t,
+						uint64_t threshold, int trials, double *cycles);
+
+/*
+ * Returns a copy of ev without the lines that are not needed to keep the
+ * eviction rate with traversal t at or above min_rate. Lines are dropped in
+ * chunks first, then one by one, so that sets spanning many cache sets take
+ * far fewer measurements than one per line.
+ */
+struct flat_ev *ev_minimize(const struct flat_ev *ev, const struct flat_ev *targets, struct ev_traversal t,
+							uint64_t threshold, double min_rate);
+
+/*
+ * Minimizes ev for each traversal pattern and returns the set with the
+ * lowest cycles per eviction, described in report. If no pattern reaches
+ * min_rate, returns a copy of ev with the four-pass overlapping traversal
+ * the experiments used before, and report tells how far off it is.
+ */
+struct flat_ev *ev_optimize(const struct flat_ev *ev, const struct flat_ev *targets, double min_rate,
+							struct ev_report *report);
+
+void ev_print_report(FILE *stream, const char *name, const struct ev_report *report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EV_VALIDATE_H_
@@ -0,0 +1,119 @@
+/**
+ * eviction_set_builder.cpp
+ *
+ * See eviction_set_builder.h.
+ */
+
+#include "eviction_set_builder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+/*
+ * Takes the lines of one set of spec from the index
+ */
+static void take_set_lines(struct slice_index *index, const struct ev_spec *spec, uint32_t set, void **lines)
+{
+	size_t n;
+	if (spec->slice == EV_ANY_SLICE) {
+		for (n = 0; n < (size_t)spec->ways; n++) {
+			lines[n] = slice_index_pop_any(index, set);
+			if (lines[n] == NULL) {
+				break;
+			}
+		}
+	} else {
+		n = slice_index_pop_congruent(index, spec->slice, set, lines, spec->ways);
+	}
+
+	if (n != (size_t)spec->ways) {
+		fprintf(stderr, "Not enough addresses on slice %d and set %" PRIu32 " in the buffer!\n", spec->slice, set);
+		exit(1);
+	}
+}
+
+/*
+ * Takes all the lines of spec, in the order given by its layout
+ */
+static std::vector<void *> take_lines(struct slice_index *index, const struct ev_spec *spec)
+{
+	std::vector<void *> by_set(ev_spec_size(spec));
+	for (int s = 0; s < spec->n_sets; s++) {
+		take_set_lines(index, spec, spec->sets[s], &by_set[s * spec->ways]);
+	}
+
+	if (spec->layout == EV_LAYOUT_SEQUENTIAL) {
+		return by_set;
+	}
+
+	std::vector<void *> lines;
+	lines.reserve(by_set.size());
+	for (int w = 0; w < spec->ways; w++) {
+		for (int s = 0; s < spec->n_sets; s++) {
+			lines.push_back(by_set[s * spec->ways + w]);
+		}
+	}
+	return lines;
+}
+
+/*
+ * Appends lines to the list at head, walking the existing list only once
+ */
+static void append_lines(struct Node **head, const std::vector<void *> &lines)
+{
+	struct Node **tail = head;
+	while (*tail != NULL) {
+		tail = &(*tail)->next;
+	}
+
+	for (void *line : lines) {
+		struct Node *node = (struct Node *)malloc(sizeof(*node));
+		node->address = line;
+		node->next = NULL;
+		*tail = node;
+		tail = &node->next;
+	}
+}
+
+void build_eviction_set(struct slice_index *index, const struct ev_spec *spec, struct Node **head)
+{
+	append_lines(head, take_lines(index, spec));
+}
+
+void build_eviction_sets(struct slice_index *index, const struct ev_spec *specs, int n_specs, struct Node **heads)
+{
+	std::vector<std::vector<void *>> lines(n_specs);
+	for (int i = 0; i < n_specs; i++) {
+		lines[i] = take_lines(index, &specs[i]);
+	}
+	for (int i = 0; i < n_specs; i++) {
+		append_lines(&heads[i], lines[i]);
+	}
+}
+
+struct flat_ev *build_flat_ev(struct slice_index *index, const struct ev_spec *specs, int n_specs)
+{
+	std::vector<void *> lines;
+	for (int i = 0; i < n_specs; i++) {
+		std::vector<void *> spec_lines = take_lines(index, &specs[i]);
+		lines.insert(lines.end(), spec_lines.begin(), spec_lines.end());
+	}
+
+	struct flat_ev *ev = flat_ev_alloc(lines.size());
+	for (size_t i = 0; i < lines.size(); i++) {
+		ev->lines[i] = lines[i];
+	}
+	return ev;
+}
+
+void **build_pointer_chase(struct slice_index *index, const struct ev_spec *spec)
+{
+	std::vector<void *> lines = take_lines(index, spec);
+
+	// The idea is: *addr1 = addr2; *addr2 = addr3; and so on, and the last one back to the first
+	for (size_t i = 0; i < lines.size(); i++) {
+		*(void **)lines[i] = lines[(i + 1) % lines.size()];
+	}
+	return (void **)lines[0];
+}
@@ -0,0 +1,87 @@
+/**
+ * eviction_set_builder.h
+ *
+ * Builds the eviction and monitoring sets of the experiments from a
+ * declarative description, on top of a slice_index (see slice_index.h).
+ *
+ * A set is described by its target slice, the sets its lines map to, the
+ * number of lines per set, and the order of the lines in the output:
+ *
+ *   uint32_t sets[] = {0, 165};
+ *   struct ev_spec spec = {slice, sets, 2, 20, EV_LAYOUT_INTERLEAVED};
+ *   build_eviction_set(index, &spec, &ev);
+ *
+ * The lines of each set are congruent in the L1, the L2 and (on the target
+ * slice) the LLC: the first one is on the given LLC set and the others share
+ * its L2 set. With EV_ANY_SLICE the sets are L2 sets and the slice of the
+ * lines does not matter, so nothing has to be classified.
+ *
+ * All the sets built from one index are disjoint.
+ */
+
+#ifndef EVICTION_SET_BUILDER_H_
+#define EVICTION_SET_BUILDER_H_
+
+#include "util.h"
+#include "slice_index.h"
+#include "flat_ev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EV_ANY_SLICE -1
+
+enum ev_layout {
+	EV_LAYOUT_SEQUENTIAL,	// all the lines of a set, then the lines of the next set
+	EV_LAYOUT_INTERLEAVED,	// one line of each set in turn
+};
+
+struct ev_spec {
+	int slice;				// target slice, or EV_ANY_SLICE
+	const uint32_t *sets;	// LLC sets (L2 sets with EV_ANY_SLICE)
+	int n_sets;
+	int ways;				// lines per set
+	enum ev_layout layout;
+};
+
+/*
+ * Appends the lines of the set described by spec to the list at head.
+ * Exits if the buffer does not have enough such lines.
+ */
+void build_eviction_set(struct slice_index *index, const struct ev_spec *spec, struct Node **head);
+
+/*
+ * Builds n_specs sets, appending the lines of specs[i] to heads[i].
+ * The lines are taken from the index spec by spec and set by set, as by
+ * build_eviction_set(); the lists are only assembled once all the lines are
+ * taken, so a spec that cannot be met exits before any list is modified.
+ */
+void build_eviction_sets(struct slice_index *index, const struct ev_spec *specs, int n_specs, struct Node **heads);
+
+/*
+ * Builds the set described by spec as a circular pointer chase through the
+ * lines themselves: the first word of each line points to the next line.
+ * Returns the first line.
+ */
+void **build_pointer_chase(struct slice_index *index, const struct ev_spec *spec);
+
+/*
+ * Builds one flat set (see flat_ev.h) with the lines of specs[0], then
+ * those of specs[1], and so on.
+ */
+struct flat_ev *build_flat_ev(struct slice_index *index, const struct ev_spec *specs, int n_specs);
+
+/*
+ * Number of lines of the set described by spec
+ */
+static inline int ev_spec_size(const struct ev_spec *spec)
+{
+	return spec->n_sets * spec->ways;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EVICTION_SET_BUILDER_H_
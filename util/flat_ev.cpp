@@ -0,0 +1,55 @@
+/**
+ * flat_ev.cpp
+ *
+ * See flat_ev.h.
+ */
+
+#include "flat_ev.h"
+#include "machine_const.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct flat_ev *flat_ev_alloc(int size)
+{
+	struct flat_ev *ev = (struct flat_ev *)malloc(sizeof(*ev));
+	size_t bytes = ((size * sizeof(void *) + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE) * CACHE_BLOCK_SIZE;
+	ev->lines = (void **)aligned_alloc(CACHE_BLOCK_SIZE, bytes ? bytes : CACHE_BLOCK_SIZE);
+	if (ev->lines == NULL) {
+		perror("aligned_alloc");
+		exit(1);
+	}
+	ev->size = size;
+	return ev;
+}
+
+void flat_ev_free(struct flat_ev *ev)
+{
+	if (ev) {
+		free(ev->lines);
+		free(ev);
+	}
+}
+
+struct flat_ev *flat_ev_from_list(const struct Node *head)
+{
+	int size = 0;
+	for (const struct Node *n = head; n != NULL; n = n->next) {
+		size++;
+	}
+
+	struct flat_ev *ev = flat_ev_alloc(size);
+	int i = 0;
+	for (const struct Node *n = head; n != NULL; n = n->next) {
+		ev->lines[i++] = n->address;
+	}
+	return ev;
+}
+
+void **flat_ev_link(const struct flat_ev *ev)
+{
+	for (int i = 0; i < ev->size; i++) {
+		*(void **)ev->lines[i] = ev->lines[(i + 1) % ev->size];
+	}
+	return ev->size ? (void **)ev->lines[0] : NULL;
+}
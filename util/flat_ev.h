@@ -0,0 +1,103 @@
+/**
+ * flat_ev.h
+ *
+ * Flat eviction sets and the kernels that traverse them.
+ *
+ * The addresses of a struct flat_ev are stored in one cache-aligned array,
+ * so a traversal touches the lines under test plus size / 8 lines of
+ * addresses, instead of one heap-allocated struct Node per line.
+ * flat_ev_link() additionally chains the lines through their own first word,
+ * for traversals that should touch nothing but the lines under test.
+ */
+
+#ifndef FLAT_EV_H_
+#define FLAT_EV_H_
+
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct flat_ev {
+	void **lines;	// line addresses, in a cache-aligned allocation
+	int size;
+};
+
+struct flat_ev *flat_ev_alloc(int size);
+void flat_ev_free(struct flat_ev *ev);
+
+/*
+ * Copies the addresses of a struct Node list
+ */
+struct flat_ev *flat_ev_from_list(const struct Node *head);
+
+/*
+ * Makes the first word of each line point to the next line, and the last
+ * one to the first. Returns the first line.
+ */
+void **flat_ev_link(const struct flat_ev *ev);
+
+/*
+ * Loads every line once, four independent loads at a time.
+ */
+static inline void flat_ev_load(const struct flat_ev *ev)
+{
+	void **lines = ev->lines;
+	int i = 0;
+	for (; i + 4 <= ev->size; i += 4) {
+		maccess(lines[i]);
+		maccess(lines[i + 1]);
+		maccess(lines[i + 2]);
+		maccess(lines[i + 3]);
+	}
+	for (; i < ev->size; i++) {
+		maccess(lines[i]);
+	}
+}
+
+/*
+ * Loads the lines with a sliding window of three (a b c a b c, then b c d
+ * b c d, and so on), passes times. This is the pattern the receivers have
+ * always used to evict their private caches.
+ */
+static inline void flat_ev_load_overlapping(const struct flat_ev *ev, int passes)
+{
+	void **lines = ev->lines;
+	for (int j = 0; j < passes; j++) {
+		for (int i = 0; i + 2 < ev->size; i++) {
+			maccess(lines[i]);
+			maccess(lines[i + 1]);
+			maccess(lines[i + 2]);
+			maccess(lines[i]);
+			maccess(lines[i + 1]);
+			maccess(lines[i + 2]);
+		}
+	}
+}
+
+/*
+ * Follows a chain built by flat_ev_link() for n lines, each load depending
+ * on the previous one. Returns the line where it stopped.
+ */
+static inline void **flat_ev_chase(void **start, int n)
+{
+	void **p = start;
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		p = *(void **volatile *)p;
+		p = *(void **volatile *)p;
+		p = *(void **volatile *)p;
+		p = *(void **volatile *)p;
+	}
+	for (; i < n; i++) {
+		p = *(void **volatile *)p;
+	}
+	return p;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLAT_EV_H_
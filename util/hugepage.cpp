@@ -0,0 +1,75 @@
+/**
+ * hugepage.cpp
+ *
+ * See hugepage.h.
+ */
+
+#include "hugepage.h"
+#include "pagemap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+int hugepage_shift(int page_shift)
+{
+	static int default_shift = -1;
+	if (page_shift == 30) {
+		return page_shift;
+	}
+	if (default_shift < 0) {
+		default_shift = page_shift;
+		FILE *f = fopen("/proc/meminfo", "r");
+		char line[128];
+		unsigned long kb;
+		while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+			if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 && kb != 0) {
+				default_shift = __builtin_ctzl(kb) + 10;
+				break;
+			}
+		}
+		if (f != NULL) {
+			fclose(f);
+		}
+	}
+	return default_shift;
+}
+
+size_t hugepage_round(size_t size, int page_shift)
+{
+	size_t page_size = 1UL << hugepage_shift(page_shift);
+	return (size + page_size - 1) & ~(page_size - 1);
+}
+
+void *hugepage_alloc(size_t size, int page_shift)
+{
+	size_t mapped = hugepage_round(size, page_shift);
+	// Only 1 GB pages are asked for by size; the default hugepages need no
+	// flag, and are not 2 MB on every kernel
+	int flags = MAP_ANON | MAP_PRIVATE | MAP_HUGETLB;
+	if (page_shift == 30) {
+		flags |= page_shift << MAP_HUGE_SHIFT;
+	}
+	page_shift = hugepage_shift(page_shift);
+	void *buffer = mmap(NULL, mapped, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (buffer == MAP_FAILED) {
+		perror("mmap hugepages");
+		fprintf(stderr, "hugepage_alloc: %zu pages of %lu kB are needed, reserve them with util/setup.sh\n",
+				mapped >> page_shift, (1UL << page_shift) >> 10);
+		exit(1);
+	}
+
+	// Write data to the buffer so that any copy-on-write
+	// mechanisms will give us our own copies of the pages.
+	memset(buffer, 0, mapped);
+	return buffer;
+}
+
+void hugepage_free(void *buffer, size_t size, int page_shift)
+{
+	size_t mapped = hugepage_round(size, page_shift);
+	munmap(buffer, mapped);
+	// A later buffer can be mapped at the same addresses
+	get_pagemap_translator().invalidate((uint64_t)buffer, mapped);
+}
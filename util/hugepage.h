@@ -0,0 +1,64 @@
+/**
+ * hugepage.h
+ *
+ * Allocation of the hugepage buffers of the experiments.
+ *
+ * By default the buffers are backed by the default hugepages of the kernel
+ * (2 MB with 4 KB base pages, 512 MB on arm64 with 64 KB base pages). Building with
+ * -DHUGEPAGE_1GB (make HUGEPAGE_1GB=1) backs them with 1 GB pages instead:
+ * a 400 MB buffer then sits in a single physically contiguous page, so
+ * it is translated once (see pagemap.h), the slices of all of its lines
+ * follow from one base address (see slice_hash_batch.h), and the timed
+ * loads of the experiments never miss in the TLB.
+ *
+ * 1 GB pages must be reserved beforehand (see setup.sh); the allocation
+ * fails otherwise.
+ */
+
+#ifndef HUGEPAGE_H_
+#define HUGEPAGE_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HUGEPAGE_1GB
+#define HUGEPAGE_SHIFT 30
+#else
+#define HUGEPAGE_SHIFT 21
+#endif
+#define HUGEPAGE_SIZE (1UL << HUGEPAGE_SHIFT)
+
+/*
+ * Returns the shift of the pages that actually back a buffer requested with
+ * page_shift: 30 selects 1 GB pages explicitly, anything else gets the
+ * default hugepages of the kernel (Hugepagesize in /proc/meminfo), falling
+ * back to page_shift if it cannot be read
+ */
+int hugepage_shift(int page_shift);
+
+/*
+ * Rounds size up to a multiple of the page size (see hugepage_shift())
+ */
+size_t hugepage_round(size_t size, int page_shift);
+
+/*
+ * Maps a private buffer of at least size bytes backed by hugepages (see
+ * hugepage_shift()), and writes it so that every page is faulted in.
+ * Exits on failure.
+ */
+void *hugepage_alloc(size_t size, int page_shift);
+
+/*
+ * Unmaps a buffer of hugepage_alloc() and drops its cached translations
+ * (see pagemap.h)
+ */
+void hugepage_free(void *buffer, size_t size, int page_shift);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HUGEPAGE_H_
@@ -0,0 +1,139 @@
+/**
+ * icache_flush.cpp
+ *
+ * See icache_flush.h.
+ */
+
+#include "icache_flush.h"
+#include "cache_geometry.h"
+#include "arch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define COST_SAMPLES 101
+
+typedef void (*flush_fn)(void);
+
+static flush_fn flush_code;
+static void *flush_mapping;
+static size_t flush_mapping_size;
+static size_t flush_lines;
+static uint32_t flush_line_size;
+static uint64_t flush_cost;
+static double flush_cost_ns;
+
+/*
+ * Writes an unconditional branch from the start of a line to the start of
+ * the next one, and returns the number of bytes written
+ */
+static size_t emit_branch(uint8_t *at, uint32_t line_size)
+{
+#if defined(__aarch64__)
+	uint32_t insn = 0x14000000 | ((line_size / 4) & 0x3FFFFFF);	// b .+line_size
+	memcpy(at, &insn, sizeof(insn));
+	return sizeof(insn);
+#else
+	int32_t rel = line_size - 5;	// jmp rel32, relative to the next instruction
+	at[0] = 0xE9;
+	memcpy(at + 1, &rel, sizeof(rel));
+	return 5;
+#endif
+}
+
+static size_t emit_return(uint8_t *at)
+{
+#if defined(__aarch64__)
+	uint32_t insn = 0xD65F03C0;	// ret
+	memcpy(at, &insn, sizeof(insn));
+	return sizeof(insn);
+#else
+	at[0] = 0xC3;	// ret
+	return 1;
+#endif
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void measure_cost(void)
+{
+	uint64_t samples[COST_SAMPLES];
+	flush_code();
+
+	uint64_t start_ns = now_ns();
+	for (int i = 0; i < COST_SAMPLES; i++) {
+		uint64_t start = arch_timestamp_serial();
+		flush_code();
+		samples[i] = arch_timestamp_serial() - start;
+	}
+	flush_cost_ns = (double)(now_ns() - start_ns) / COST_SAMPLES;
+
+	std::nth_element(samples, samples + COST_SAMPLES / 2, samples + COST_SAMPLES);
+	flush_cost = samples[COST_SAMPLES / 2];
+}
+
+void icache_flush_init(int cache_level)
+{
+	const struct cache_geometry *g = get_cache_geometry();
+	uint32_t line_size = g->l1i.line_size;
+	size_t size = (size_t)g->l1i.sets * g->l1i.ways * line_size;
+	if (cache_level >= 2) {
+		size = std::max(size, (size_t)g->level[2].sets * g->level[2].ways * g->level[2].line_size);
+	}
+
+	if (flush_mapping != NULL) {
+		munmap(flush_mapping, flush_mapping_size);
+	}
+	size_t page_size = getpagesize();
+	flush_mapping_size = (size + page_size - 1) / page_size * page_size;
+	flush_mapping = mmap(NULL, flush_mapping_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (flush_mapping == MAP_FAILED) {
+		perror("mmap icache flush");
+		exit(1);
+	}
+
+	uint8_t *code = (uint8_t *)flush_mapping;
+	flush_lines = size / line_size;
+	flush_line_size = line_size;
+	for (size_t i = 0; i + 1 < flush_lines; i++) {
+		emit_branch(code + i * line_size, line_size);
+	}
+	emit_return(code + (flush_lines - 1) * line_size);
+
+	if (mprotect(flush_mapping, flush_mapping_size, PROT_READ | PROT_EXEC) != 0) {
+		perror("mprotect icache flush");
+		exit(1);
+	}
+	__builtin___clear_cache((char *)code, (char *)code + size);
+	flush_code = (flush_fn)code;
+
+	measure_cost();
+}
+
+void flush_l1i(void)
+{
+	if (flush_code == NULL) {
+		icache_flush_init(1);
+	}
+	flush_code();
+}
+
+uint64_t icache_flush_cost(void)
+{
+	return flush_cost;
+}
+
+void icache_flush_print(FILE *stream)
+{
+	fprintf(stream, "I-cache flush: %zu lines of %" PRIu32 " B, %" PRIu64 " ticks (%.0f ns) per flush\n",
+			flush_lines, flush_line_size, flush_cost, flush_cost_ns);
+}
@@ -0,0 +1,50 @@
+/**
+ * icache_flush.h
+ *
+ * Instruction cache flush by execution, used to simulate the cache state
+ * of a preempted victim.
+ *
+ * The flush code is generated at startup from the discovered geometry
+ * (cache_geometry.h): one branch at the start of every line of an
+ * executable mapping to the start of the next one, and a return in the
+ * last line. The mapping covers exactly the L1 instruction cache, or the
+ * L2 when asked to, so running it once replaces every line of the cache,
+ * whatever its size on this core.
+ */
+
+#ifndef ICACHE_FLUSH_H_
+#define ICACHE_FLUSH_H_
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Generates the flush code, sized to the L1i (cache_level 1) or to the
+ * larger of the L1i and the L2 (cache_level 2), and measures its cost.
+ * Calling it again replaces the code.
+ */
+void icache_flush_init(int cache_level);
+
+/*
+ * Runs the flush code, generating it for the L1i on the first call if
+ * icache_flush_init() was not called
+ */
+void flush_l1i(void);
+
+/*
+ * Median cost of one flush_l1i() in arch_timestamp() ticks, measured by
+ * icache_flush_init()
+ */
+uint64_t icache_flush_cost(void);
+
+void icache_flush_print(FILE *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ICACHE_FLUSH_H_
@@ -1,5 +1,5 @@
 /**
- * util-cpu-specific.h
+ * machine_const.h
  * 
  * Contains processor-specific details about the machine architecture.
  */
@@ -16,51 +16,57 @@
  * The cache line/block size in my machine is 64 bytes (2^6), meaning that the
  * rightmost 6 bits of the physical address are used as cache block offset. 
  * 
- * The L1 cache in my machine has 64 cache sets (2^6)
+ * The L1 cache in my machine has 256 cache sets (2^8)
  * (cat /sys/devices/system/cpu/cpu0/cache/index0/number_of_sets).
- * That means that the next 6 bits after the block offset of the physical
+ * That means that the next 8 bits after the block offset of the physical
  * address are used as L1 cache set index.
  * 
- * The LLC cache in my machine has 53248 cache sets (26 * 2^11) (cat
- * /sys/devices/system/cpu/cpu0/cache/index3/number_of_sets).
- * However these sets are split between 26 slices
- * in my CPU.
- * That means that each slice has 2048 (2^11) cache sets.
- * Therefore in my CPU, the next 11 bits of the physical address after the block
+ * The LLC in my machine has 32768 cache sets (32 * 2^10), split between
+ * 32 slices. That means that each slice has 1024 (2^10) cache sets.
+ * Therefore in my CPU, the next 10 bits of the physical address after the block
  * offset are used as LLC cache set index within each slice.
  *
+ * These are the defaults of the geometry discovered at startup (see
+ * cache_geometry.h), which is what get_cache_set_index() uses. The eviction
+ * set code sizes its tables with the constants below, and exits if they
+ * differ from the geometry found (see check_cache_geometry()).
+ *
+ * A build therefore supports a single cache geometry: the slice index
+ * (NUM_CLASSES from L2_INDEX_STRIDE, the LLC set mask, LLC_CACHE_SLICES) is
+ * not sized at run time. For a part with other L2 or LLC set counts, even
+ * another SKU of the same family, update the constants below and rebuild.
  */
 
 #define CACHE_BLOCK_SIZE 64 // Cache block and cache line are the same thing
 #define CACHE_BLOCK_SIZE_LOG 6
 
-// 32 KiB, 8-way, 64 B/line
-// 64 sets (6 index bits)
+// 64 KiB, 4-way, 64 B/line
+// 256 sets (8 index bits)
 #define L1_CACHE_WAYS 4
 #define L1_CACHE_SETS 256
 #define L1_CACHE_SETS_LOG 8
 #define L1_CACHE_SIZE (L1_CACHE_SETS) * (L1_CACHE_WAYS) * (CACHE_BLOCK_SIZE)
 
-// 1 MiB, 16-way, 64 B/line, inclusive
-// 1024 sets (10 index bits)
+// 1 MiB, 8-way, 64 B/line
+// 2048 sets (11 index bits)
 #define L2_CACHE_WAYS 8
 #define L2_CACHE_SETS 2048
 #define L2_CACHE_SETS_LOG 11
 #define L2_CACHE_SIZE (L2_CACHE_SETS) * (L2_CACHE_WAYS) * (CACHE_BLOCK_SIZE)
 
-// 1.375 MiB, 11-way, 64 B/line, non-inclusive
-// 2048 sets (11 index bits)
+// 1 MiB per slice, 16-way, 64 B/line
+// 1024 sets per slice (10 index bits)
 #define LLC_CACHE_WAYS 16
 #define LLC_CACHE_SETS_PER_SLICE 1024
 #define LLC_CACHE_SETS_LOG 10
 #define LLC_CACHE_SLICES 32
-#define LLC_CACHE_SIZE (LLC_CACHE_SETS_TOTAL) * (LLC_CACHE_WAYS) * (CACHE_BLOCK_SIZE)
+#define LLC_CACHE_SIZE (LLC_CACHE_SETS_PER_SLICE) * (LLC_CACHE_SLICES) * (LLC_CACHE_WAYS) * (CACHE_BLOCK_SIZE)
 
 /* 
  * Set indexes 
  */
 
-#define L1_SET_INDEX_MASK 0xFC0				 /* 6 bits - [11-6] - 64 sets */
+#define L1_SET_INDEX_MASK 0x3FC0			 /* 8 bits - [13-6] - 256 sets */
 #define L2_SET_INDEX_MASK 0x1FFC0			 /* 11 bits - [16-6] - 2048 sets */
 #define LLC_SET_INDEX_PER_SLICE_MASK 0xFFC0  /* 10 bits - [15-6] - 1024 sets */
 #define LLC_INDEX_STRIDE 0x10000			 /* Offset required to get the next address with the same LLC cache set index. 16 = bit 15 (MSB bit of LLC_SET_INDEX_PER_SLICE_MASK) + 1 */
@@ -0,0 +1,50 @@
+/**
+ * mesh_topology.h
+ *
+ * Mesh layout of this machine: the CPU to pin to for each CHA (slice) ID
+ * (-1 if none, pin with cha_cpu()), and the slice of each tile of the die
+ * (-1 if none).
+ *
+ * This file is generated by tools/topology-discovery (see tools/README.md).
+ * The checked-in version is a placeholder: MESH_TOPOLOGY_DISCOVERED is 0,
+ * the die layout is unknown and cha_id_to_cpu is the identity, which only
+ * follows the naming of the slices after the probe core closest to them
+ * (see slice_probe.h) and was not measured: NUM_CHA is NUM_CORES, whether or
+ * not every CPU has a slice on its tile. Run the tool before pinning by CHA
+ * ID on a new machine.
+ */
+
+#ifndef MESH_TOPOLOGY_H_
+#define MESH_TOPOLOGY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "machine_const.h"
+
+#define MESH_TOPOLOGY_DISCOVERED 0
+#define NUM_CHA NUM_CORES
+#define NUM_CORES_PER_SOCKET NUM_CORES
+#define DIE_ROWS 0
+#define DIE_COLS 0
+
+static const int cha_id_to_cpu[NUM_CHA] __attribute__((unused)) = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+	32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+	48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63
+};
+
+/*
+ * CPU to pin to for a CHA ID. The slice IDs need not be contiguous, so exits
+ * if the ID has no CPU.
+ */
+static inline int cha_cpu(int cha)
+{
+	if (cha < 0 || cha >= NUM_CHA || cha_id_to_cpu[cha] < 0) {
+		fprintf(stderr, "CHA ID %d has no CPU (see util/mesh_topology.h)\n", cha);
+		exit(1);
+	}
+	return cha_id_to_cpu[cha];
+}
+
+#endif // MESH_TOPOLOGY_H_
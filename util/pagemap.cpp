@@ -0,0 +1,240 @@
+/**
+ * pagemap.cpp
+ *
+ * See pagemap.h. Each pagemap entry is 8 bytes and describes one 4 KB virtual
+ * page: bits 0-54 hold the PFN and bit 63 is set if the page is present.
+ * For a huge page the entries of its 4 KB subpages are contiguous, so the
+ * first one is enough to translate the whole page.
+ */
+
+#include "pagemap.h"
+#include "machine_const.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define PAGEMAP_PRESENT_BIT 63
+#define PAGEMAP_PFN_MASK 0x7FFFFFFFFFFFFFUL
+
+// Largest single pread issued on the pagemap file
+#define PAGEMAP_MAX_READ (1UL << 20)
+
+PagemapTranslator::PagemapTranslator()
+	: syscalls(0), last_va_page(0), last_pa_page(0), last_shift(0)
+{
+	fd = open("/proc/self/pagemap", O_RDONLY);
+	if (fd < 0) {
+		perror("Failed to open /proc/self/pagemap");
+		exit(1);
+	}
+}
+
+PagemapTranslator::~PagemapTranslator()
+{
+	close(fd);
+}
+
+/*
+ * Reads the page size of every mapping of the process from /proc/self/smaps
+ */
+void PagemapTranslator::load_mappings()
+{
+	FILE *smaps = fopen("/proc/self/smaps", "r");
+	if (smaps == NULL) {
+		perror("Failed to open /proc/self/smaps");
+		exit(1);
+	}
+
+	mappings.clear();
+	char line[512];
+	Mapping current = {0, 0, PAGE_SHIFT};
+	bool in_mapping = false;
+	while (fgets(line, sizeof(line), smaps)) {
+		uint64_t start, end;
+		unsigned long kb;
+		if (sscanf(line, "%" SCNx64 "-%" SCNx64 " ", &start, &end) == 2) {
+			if (in_mapping) {
+				mappings.push_back(current);
+			}
+			current = {start, end, PAGE_SHIFT};
+			in_mapping = true;
+		} else if (sscanf(line, "KernelPageSize: %lu kB", &kb) == 1) {
+			current.page_shift = __builtin_ctzl(kb * 1024);
+		}
+	}
+	if (in_mapping) {
+		mappings.push_back(current);
+	}
+	fclose(smaps);
+}
+
+int PagemapTranslator::page_shift_locked(uint64_t va)
+{
+	for (int attempt = 0; attempt < 2; attempt++) {
+		auto it = std::upper_bound(mappings.begin(), mappings.end(), va,
+								   [](uint64_t v, const Mapping &m) { return v < m.end; });
+		if (it != mappings.end() && it->start <= va) {
+			return it->page_shift;
+		}
+		// The mapping might be newer than our snapshot
+		load_mappings();
+	}
+	return PAGE_SHIFT;
+}
+
+/*
+ * Reads n_pages consecutive pages of size 1 << shift starting at first_page
+ * into the cache.
+ */
+void PagemapTranslator::read_pages(uint64_t first_page, uint64_t n_pages, int shift)
+{
+	uint64_t stride = 1UL << (shift - PAGE_SHIFT); // entries per page
+	uint64_t pages_per_read = std::max(1UL, PAGEMAP_MAX_READ / (stride * PAGEMAP_LENGTH));
+	std::vector<uint64_t> entries;
+
+	for (uint64_t done = 0; done < n_pages; done += pages_per_read) {
+		uint64_t count = std::min(pages_per_read, n_pages - done);
+		uint64_t page = first_page + (done << shift);
+		// Only the entries up to the first subpage of the last page are needed
+		uint64_t n_entries = (count - 1) * stride + 1;
+		entries.resize(n_entries);
+
+		off_t offset = (off_t)((page >> PAGE_SHIFT) * PAGEMAP_LENGTH);
+		ssize_t ret = pread(fd, entries.data(), n_entries * PAGEMAP_LENGTH, offset);
+		syscalls++;
+		if (ret < 0) {
+			fprintf(stderr, "pagemap: pread failed: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		uint64_t n_read = ret / PAGEMAP_LENGTH;
+		for (uint64_t i = 0; i < count; i++) {
+			uint64_t entry = (i * stride < n_read) ? entries[i * stride] : 0;
+			uint64_t pa_page = (entry & PAGEMAP_PFN_MASK) << PAGE_SHIFT;
+			// Pages that are not present yet, or whose PFN is hidden (no
+			// CAP_SYS_ADMIN), are read again on the next lookup
+			if (!((entry >> PAGEMAP_PRESENT_BIT) & 1) || pa_page == 0) {
+				continue;
+			}
+			// Align down in case the first entry is a subpage of a larger frame
+			pa_page &= ~((1UL << shift) - 1);
+			pages[page + (i << shift)] = pa_page;
+		}
+	}
+}
+
+uint64_t PagemapTranslator::translate_locked(uint64_t va)
+{
+	if (last_shift && (va >> last_shift) == (last_va_page >> last_shift)) {
+		return last_pa_page + (va & ((1UL << last_shift) - 1));
+	}
+
+	int shift = page_shift_locked(va);
+	uint64_t va_page = va & ~((1UL << shift) - 1);
+	auto it = pages.find(va_page);
+	if (it == pages.end()) {
+		read_pages(va_page, 1, shift);
+		it = pages.find(va_page);
+		if (it == pages.end()) {
+			return 0;
+		}
+	}
+
+	last_va_page = va_page;
+	last_pa_page = it->second;
+	last_shift = shift;
+	return it->second + (va - va_page);
+}
+
+uint64_t PagemapTranslator::translate(uint64_t va)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return translate_locked(va);
+}
+
+void PagemapTranslator::translate(const uint64_t *va, uint64_t *pa, size_t n)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	// Collect the pages that are not cached yet
+	std::vector<std::pair<uint64_t, int>> missing;
+	for (size_t i = 0; i < n; i++) {
+		int shift = page_shift_locked(va[i]);
+		uint64_t va_page = va[i] & ~((1UL << shift) - 1);
+		if (pages.find(va_page) == pages.end()) {
+			missing.push_back({va_page, shift});
+		}
+	}
+	std::sort(missing.begin(), missing.end());
+	missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+	// Read each run of consecutive pages with a single pread
+	size_t run_start = 0;
+	for (size_t i = 1; i <= missing.size(); i++) {
+		if (i == missing.size() ||
+			missing[i].second != missing[run_start].second ||
+			missing[i].first != missing[i - 1].first + (1UL << missing[i - 1].second)) {
+			read_pages(missing[run_start].first, i - run_start, missing[run_start].second);
+			run_start = i;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		pa[i] = translate_locked(va[i]);
+	}
+}
+
+void PagemapTranslator::prefetch(uint64_t va, size_t len)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	uint64_t end = va + len;
+	while (va < end) {
+		int shift = page_shift_locked(va);
+		uint64_t page_size = 1UL << shift;
+		uint64_t first_page = va & ~(page_size - 1);
+
+		// Stop the run at the end of the range or of the mapping
+		uint64_t run_end = end;
+		for (const Mapping &m : mappings) {
+			if (m.start <= va && va < m.end) {
+				run_end = std::min(run_end, m.end);
+				break;
+			}
+		}
+		uint64_t n_pages = (run_end - first_page + page_size - 1) >> shift;
+		read_pages(first_page, n_pages, shift);
+		va = first_page + (n_pages << shift);
+	}
+}
+
+int PagemapTranslator::page_shift(uint64_t va)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return page_shift_locked(va);
+}
+
+void PagemapTranslator::invalidate(uint64_t va, size_t len)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	// The pages are cached by their base, which is in the range if it was
+	// mapped as a whole
+	for (auto it = pages.begin(); it != pages.end();) {
+		it = it->first >= va && it->first < va + len ? pages.erase(it) : std::next(it);
+	}
+	last_shift = 0;
+	// A new mapping of the range can have another page size
+	mappings.clear();
+}
+
+PagemapTranslator &get_pagemap_translator(void)
+{
+	static PagemapTranslator translator;
+	return translator;
+}
@@ -0,0 +1,90 @@
+/**
+ * pagemap.h
+ *
+ * Virtual to physical address translation through /proc/self/pagemap.
+ *
+ * A single file descriptor is kept open and translations are cached at the
+ * granularity of the page backing each mapping (2 MB for the MAP_HUGETLB
+ * buffers of the experiments, 1 GB for MAP_HUGE_1GB ones, 4 KB otherwise),
+ * so translating every line of a hugepage buffer costs one pread per page.
+ *
+ * Reading PFNs requires CAP_SYS_ADMIN (run the experiments with sudo).
+ */
+
+#ifndef PAGEMAP_H_
+#define PAGEMAP_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class PagemapTranslator {
+public:
+	PagemapTranslator();
+	~PagemapTranslator();
+
+	PagemapTranslator(const PagemapTranslator &) = delete;
+	PagemapTranslator &operator=(const PagemapTranslator &) = delete;
+
+	/*
+	 * Returns the physical address of va, or 0 if the page is not present.
+	 */
+	uint64_t translate(uint64_t va);
+
+	/*
+	 * Translates n addresses. Pages not yet cached are read with one pread
+	 * per run of consecutive pages.
+	 */
+	void translate(const uint64_t *va, uint64_t *pa, size_t n);
+
+	/*
+	 * Reads the translations of every page in [va, va + len) upfront.
+	 */
+	void prefetch(uint64_t va, size_t len);
+
+	/*
+	 * Returns log2 of the size of the page backing va.
+	 */
+	int page_shift(uint64_t va);
+
+	/*
+	 * Drops the cached translations of the pages in [va, va + len), so that
+	 * a later mapping at the same addresses is read again. Call it after
+	 * unmapping a buffer.
+	 */
+	void invalidate(uint64_t va, size_t len);
+
+	uint64_t get_syscalls() const { return syscalls; }
+
+private:
+	struct Mapping {
+		uint64_t start;
+		uint64_t end;
+		int page_shift;
+	};
+
+	int fd;
+	uint64_t syscalls;
+	std::mutex lock;
+	std::vector<Mapping> mappings;
+	// Page base (VA) -> page base (PA), of the pages found present only
+	std::unordered_map<uint64_t, uint64_t> pages;
+	// Last translated page, to skip the hash lookup on sequential scans
+	uint64_t last_va_page;
+	uint64_t last_pa_page;
+	int last_shift;
+
+	void load_mappings();
+	int page_shift_locked(uint64_t va);
+	uint64_t translate_locked(uint64_t va);
+	void read_pages(uint64_t first_page, uint64_t n_pages, int shift);
+};
+
+/*
+ * Process-wide translator used by the util functions.
+ */
+PagemapTranslator &get_pagemap_translator(void);
+
+#endif // PAGEMAP_H_
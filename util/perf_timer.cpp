@@ -0,0 +1,157 @@
+/**
+ * perf_timer.cpp
+ *
+ * See perf_timer.h.
+ */
+
+#include "perf_timer.h"
+
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CALIBRATION_NS 20000000	// 20 ms
+
+// config1 bits of the arm PMU driver: 64-bit counter, user access
+#define ARMV8_PMU_CONFIG1_LONG 0x1
+#define ARMV8_PMU_CONFIG1_RDPMC 0x2
+
+// perf index of the aarch64 cycle counter (PMCCNTR_EL0)
+#define ARMV8_CYCLE_COUNTER_INDEX 32
+
+#if defined(__x86_64__)
+uint32_t perf_timer_counter;
+#endif
+
+static struct perf_timer_calibration calibration;
+
+// Event of the last perf_timer_open()
+static int perf_fd = -1;
+static struct perf_event_mmap_page *perf_page;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void calibrate(void)
+{
+	uint64_t ns0 = now_ns();
+	uint64_t tick0 = arch_timestamp_serial();
+	uint64_t cycle0 = perf_timer_read_serial();
+
+	uint64_t ns1;
+	do {
+		ns1 = now_ns();
+	} while (ns1 - ns0 < CALIBRATION_NS);
+
+	uint64_t tick1 = arch_timestamp_serial();
+	uint64_t cycle1 = perf_timer_read_serial();
+
+	calibration.cycles_per_tick = (double)(cycle1 - cycle0) / (tick1 - tick0);
+	calibration.cycle_ghz = (double)(cycle1 - cycle0) / (ns1 - ns0);
+	calibration.tick_ghz = (double)(tick1 - tick0) / (ns1 - ns0);
+}
+
+bool perf_timer_open(void)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+#if defined(__aarch64__)
+	attr.config1 = ARMV8_PMU_CONFIG1_LONG | ARMV8_PMU_CONFIG1_RDPMC;
+#endif
+
+	int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd < 0) {
+		perror("perf_event_open");
+		return false;
+	}
+
+	struct perf_event_mmap_page *page = (struct perf_event_mmap_page *)mmap(NULL, getpagesize(), PROT_READ,
+																			MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED) {
+		perror("mmap perf_event");
+		close(fd);
+		return false;
+	}
+
+	// The index is only meaningful while the event is scheduled, read it
+	// under the seqlock like the perf tools do
+	uint32_t seq, index;
+	bool user_access;
+	do {
+		seq = page->lock;
+		__sync_synchronize();
+		index = page->index;
+		user_access = page->cap_user_rdpmc;
+		__sync_synchronize();
+	} while (page->lock != seq);
+
+	if (!user_access || index == 0) {
+		fprintf(stderr, "perf_timer: the cycle counter is not readable from user space");
+#if defined(__aarch64__)
+		fprintf(stderr, " (needs Linux 5.17+ and /proc/sys/kernel/perf_user_access = 1)");
+#endif
+		fprintf(stderr, "\n");
+		munmap(page, getpagesize());
+		close(fd);
+		return false;
+	}
+#if defined(__aarch64__)
+	if (index != ARMV8_CYCLE_COUNTER_INDEX) {
+		fprintf(stderr, "perf_timer: got counter %" PRIu32 " instead of the cycle counter\n", index - 1);
+		munmap(page, getpagesize());
+		close(fd);
+		return false;
+	}
+#else
+	perf_timer_counter = index - 1;
+#endif
+
+	// The fd and the page stay open until perf_timer_close()
+	perf_fd = fd;
+	perf_page = page;
+	return true;
+}
+
+void perf_timer_close(void)
+{
+	if (perf_fd < 0) {
+		return;
+	}
+	munmap(perf_page, getpagesize());
+	close(perf_fd);
+	perf_fd = -1;
+	perf_page = NULL;
+}
+
+void perf_timer_init(void)
+{
+	if (!perf_timer_open()) {
+		exit(1);
+	}
+	calibrate();
+}
+
+const struct perf_timer_calibration *perf_timer_get_calibration(void)
+{
+	return &calibration;
+}
+
+void perf_timer_print_calibration(FILE *stream)
+{
+	fprintf(stream, "PMU cycle counter: %.3f GHz, %.2f cycles per timestamp tick (timestamp %.3f GHz)\n",
+			calibration.cycle_ghz, calibration.cycles_per_tick, calibration.tick_ghz);
+}
@@ -0,0 +1,112 @@
+/**
+ * perf_timer.h
+ *
+ * Timer backend that reads the PMU cycle counter from user space, through
+ * perf_event_open self-monitoring.
+ *
+ * The generic timer (cntvct_el0) ticks at a fixed low frequency, so a single
+ * LLC hit is shorter than one tick. The cycle counter ticks at the core
+ * frequency. perf_timer_init() opens a cycles event for the calling thread
+ * with user access enabled, maps its control page and checks that the kernel
+ * handed out a counter readable from user space. After that, reading the
+ * counter is one mrs (rdpmc on x86-64), with no system call.
+ *
+ * On aarch64 user access needs Linux 5.17 or later and
+ *   echo 1 | sudo tee /proc/sys/kernel/perf_user_access
+ *
+ * The counter is per thread and is not synchronized across cores: use it
+ * to time windows on one core, and the generic timer for timestamps that
+ * are compared across cores.
+ */
+
+#ifndef PERF_TIMER_H_
+#define PERF_TIMER_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "arch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct perf_timer_calibration {
+	double cycles_per_tick;	// PMU cycles per arch_timestamp() tick
+	double cycle_ghz;		// PMU cycles per nanosecond
+	double tick_ghz;		// arch_timestamp() ticks per nanosecond
+};
+
+#if defined(__x86_64__)
+// rdpmc counter number, set by perf_timer_init()
+extern uint32_t perf_timer_counter;
+#endif
+
+/*
+ * Opens and maps the cycles event of the calling thread. Returns false,
+ * with the reason on stderr, if the counter cannot be read from user space.
+ */
+bool perf_timer_open(void);
+
+/*
+ * Unmaps and closes the event of the last perf_timer_open(), from the same
+ * thread. The counter cannot be read afterwards.
+ */
+void perf_timer_close(void);
+
+/*
+ * Opens and maps the cycles event of the calling thread, and calibrates it
+ * against arch_timestamp(). Exits if the counter cannot be read from user
+ * space. Must be called from the thread (and on the core) that reads it.
+ */
+void perf_timer_init(void);
+
+/*
+ * Calibration measured by perf_timer_init()
+ */
+const struct perf_timer_calibration *perf_timer_get_calibration(void);
+
+void perf_timer_print_calibration(FILE *stream);
+
+ARCH_INLINE uint64_t perf_timer_read(void)
+{
+#if defined(__aarch64__)
+	uint64_t t;
+	asm volatile("mrs %0, pmccntr_el0" : "=r"(t));
+	return t;
+#else
+	uint32_t lo, hi;
+	asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(perf_timer_counter));
+	return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+/*
+ * Serialized like arch_timestamp_serial()
+ */
+ARCH_INLINE uint64_t perf_timer_read_serial(void)
+{
+#if defined(__aarch64__)
+	uint64_t t;
+	asm volatile(
+		"isb\n\t"
+		"mrs %0, pmccntr_el0\n\t"
+		"isb"
+		: "=r"(t)::"memory");
+	return t;
+#else
+	uint32_t lo, hi;
+	asm volatile(
+		"lfence\n\t"
+		"rdpmc\n\t"
+		"lfence"
+		: "=a"(lo), "=d"(hi) : "c"(perf_timer_counter) : "memory");
+	return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PERF_TIMER_H_
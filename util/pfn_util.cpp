@@ -1,52 +1,17 @@
-#include "util.h"
-#include "pfn_util.h"
-#include <errno.h>
-#include <inttypes.h>
-#include <string.h>
-
-uint64_t get_physical_frame_number(uint64_t vpn) {
-	// printf("check vpn = 0x%lx\n", vpn);
-	int i;
-	// int pid = getpid();
-	// string pagemap_path = "/proc/"+to_string(getpid())+"/pagemap";
-	// FILE *f = fopen(pagemap_path.c_str(), "rb");
-
-	/* Open the pagemap file for the current process */
-	FILE *f = fopen("/proc/self/pagemap", "rb");
-
-	if(f==NULL){
-			printf("Error! Cannot open /proc/self/pagemap: %s\n", strerror(errno));
-			abort();
-	}
-
-	uint64_t file_offset = vpn * PAGEMAP_ENTRY_SIZE;
-	int ret = fseek(f, file_offset, SEEK_SET);
-	if(ret !=0 ){
-		printf("Error in fseek\n");
-		abort();
-	}
-
-	uint64_t read_val = 0;
-
-	ret = fread(&read_val, PAGEMAP_ENTRY_SIZE, 1, f);
-	fclose(f);
-	if(ret <0 ){
-		printf("Error in fread\n");
-		abort();
-	}
-
-	// printf("reav_val = 0x%lx\n", read_val);
-	if(GET_BIT(read_val, 63)){
-		// printf("VPN: 0x%lx; PFN: 0x%llx\n",
-		// 	vpn, (unsigned long long) GET_PFN(read_val));
-		return GET_PFN(read_val);
-	}else
-		printf("Page not present\n");
-
-	if(GET_BIT(read_val, 62))
-		printf("Page swapped\n");
-
-
-	return 0;
-
-}
\ No newline at end of file
+#include "util.h"
+#include "pfn_util.h"
+#include "pagemap.h"
+#include <inttypes.h>
+
+/*
+ * Returns the PFN of the 4 KB virtual page vpn.
+ * Translations come from the process-wide PagemapTranslator, which keeps
+ * /proc/self/pagemap open and caches them per (huge) page.
+ */
+uint64_t get_physical_frame_number(uint64_t vpn) {
+	uint64_t pa = get_pagemap_translator().translate(vpn << PAGE_SHIFT);
+	if (pa == 0) {
+		printf("Page not present\n");
+	}
+	return pa >> PAGE_SHIFT;
+}
@@ -8,6 +8,14 @@
 //0-54 bit -> PFN
 #define GET_PFN(X) X & 0x7FFFFFFFFFFFFF
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 uint64_t get_physical_frame_number(uint64_t vpn);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
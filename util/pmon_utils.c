@@ -9,6 +9,7 @@
 #include "pmon_utils.h"
 #include "pmon_reg_defs.h"
 #include "machine_const.h"
+#include "mesh_topology.h"
 
 #include <fcntl.h>          // open(), close()
 #include <errno.h>          // errno
@@ -17,7 +18,7 @@
 #include <stdio.h>          // printf(), sprintf(), etc
 #include <stdlib.h>         // exit()
 #include <assert.h>         // assert()
-#include <x86intrin.h>
+#include "arch.h"
 
 char filename[MAX_FILENAME_LEN];
 
@@ -232,7 +233,7 @@ int get_corresponding_cha_no_msr(void *virtual_address, int msr_fd[NUM_LOG_CORES
     // counting has started
 
     for (int i = 0; i < CHA_TEST_REPS; i++) {
-        _mm_clflush((char *)virtual_address);
+        arch_flush(virtual_address);
         result = *(char *)virtual_address;
     }
 
@@ -0,0 +1,154 @@
+/**
+ * probe_kernel.cpp
+ *
+ * See probe_kernel.h. The kernels are instances of one template, unrolled
+ * by the compiler for each number of loads (the Makefiles build util/ at
+ * -O3).
+ */
+
+#include "probe_kernel.h"
+#include "perf_timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+template <bool PMU, bool SERIAL>
+static inline __attribute__((always_inline)) uint64_t read_timer(void)
+{
+	if (PMU) {
+		return SERIAL ? perf_timer_read_serial() : perf_timer_read();
+	}
+	return SERIAL ? arch_timestamp_serial() : arch_timestamp();
+}
+
+/*
+ * The window of the independent loads. The lines are passed as arguments
+ * rather than read from an array: the serialized timer reads clobber memory,
+ * so an array would be spilled to the stack and reloaded inside the window.
+ */
+template <bool PMU, enum probe_fence FENCE, typename... Lines>
+static inline __attribute__((always_inline)) uint32_t time_loads(uint64_t *start, Lines... lines)
+{
+	constexpr bool serial = FENCE != PROBE_FENCE_NONE;
+
+	if (FENCE == PROBE_FENCE_FULL) {
+		arch_fence();
+	}
+	*start = read_timer<PMU, serial>();
+	(arch_load(lines), ...);
+	if (FENCE == PROBE_FENCE_FULL) {
+		arch_fence();
+	}
+	return read_timer<PMU, serial>() - *start;
+}
+
+template <bool PMU, int LOADS, bool CHASE, enum probe_fence FENCE>
+static uint32_t probe(struct probe_cursor *cursor, uint64_t *timestamp)
+{
+	constexpr bool serial = FENCE != PROBE_FENCE_NONE;
+	uint64_t start;
+	uint32_t latency;
+
+	if (CHASE) {
+		void **chain = cursor->chain;
+
+		if (FENCE == PROBE_FENCE_FULL) {
+			arch_fence();
+		}
+		start = read_timer<PMU, serial>();
+		for (int j = 0; j < LOADS; j++) {
+			chain = arch_load_chain(chain);
+		}
+		if (FENCE == PROBE_FENCE_FULL) {
+			arch_fence();
+		}
+		latency = read_timer<PMU, serial>() - start;
+		cursor->chain = chain;
+	} else {
+		void *p[LOADS];
+
+		for (int j = 0; j < LOADS; j++) {
+			p[j] = cursor->lines[cursor->next];
+			cursor->next = cursor->next + 1 == cursor->size ? 0 : cursor->next + 1;
+		}
+		latency = [&]<size_t... J>(std::index_sequence<J...>) {
+			return time_loads<PMU, FENCE>(&start, p[J]...);
+		}(std::make_index_sequence<LOADS>());
+	}
+
+	// The PMU counter is per core
+	*timestamp = PMU ? arch_timestamp() : start;
+	return latency;
+}
+
+#define KERNEL(TIMER, PMU, LOADS, MODE, CHASE, FENCE_NAME, FENCE)                            \
+	{#LOADS "-" MODE "-" FENCE_NAME, TIMER, LOADS, CHASE, FENCE, probe<PMU, LOADS, CHASE, FENCE>}
+
+#define KERNELS_OF_MODE(TIMER, PMU, LOADS, MODE, CHASE)                       \
+	KERNEL(TIMER, PMU, LOADS, MODE, CHASE, "serial", PROBE_FENCE_SERIAL),     \
+	KERNEL(TIMER, PMU, LOADS, MODE, CHASE, "full", PROBE_FENCE_FULL),         \
+	KERNEL(TIMER, PMU, LOADS, MODE, CHASE, "none", PROBE_FENCE_NONE)
+
+#define KERNELS_OF_SIZE(TIMER, PMU, LOADS)               \
+	KERNELS_OF_MODE(TIMER, PMU, LOADS, "load", false),   \
+	KERNELS_OF_MODE(TIMER, PMU, LOADS, "chase", true)
+
+#define KERNELS_OF_TIMER(TIMER, PMU)     \
+	KERNELS_OF_SIZE(TIMER, PMU, 1),      \
+	KERNELS_OF_SIZE(TIMER, PMU, 2),      \
+	KERNELS_OF_SIZE(TIMER, PMU, 4),      \
+	KERNELS_OF_SIZE(TIMER, PMU, 8),      \
+	KERNELS_OF_SIZE(TIMER, PMU, 16)
+
+static const struct probe_kernel kernels[] = {
+	KERNELS_OF_TIMER("generic", false),
+	KERNELS_OF_TIMER("pmu", true),
+};
+
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+const struct probe_kernel *probe_kernel_find(const char *name, const char *timer_backend)
+{
+	// The fence can be left out
+	char canonical[32];
+	snprintf(canonical, sizeof(canonical), "%s", name);
+	if (strchr(name, '-') == strrchr(name, '-')) {
+		snprintf(canonical, sizeof(canonical), "%s-serial", name);
+	}
+
+	for (size_t k = 0; k < N_KERNELS; k++) {
+		if (strcmp(kernels[k].timer, timer_backend) == 0 && strcmp(kernels[k].name, canonical) == 0) {
+			return &kernels[k];
+		}
+	}
+	return NULL;
+}
+
+const struct probe_kernel *probe_kernel_select(const char *name, const char *timer_backend)
+{
+	const struct probe_kernel *kernel = probe_kernel_find(name, timer_backend);
+	if (kernel == NULL) {
+		fprintf(stderr, "Unknown probe kernel %s, the kernels are:\n", name);
+		probe_kernel_list(stderr);
+		exit(1);
+	}
+	return kernel;
+}
+
+void probe_kernel_list(FILE *stream)
+{
+	for (size_t k = 0; k < N_KERNELS; k++) {
+		if (strcmp(kernels[k].timer, kernels[0].timer) == 0) {
+			fprintf(stream, "  %s\n", kernels[k].name);
+		}
+	}
+}
+
+void probe_cursor_init(struct probe_cursor *cursor, const struct probe_kernel *kernel, const struct flat_ev *set)
+{
+	cursor->lines = set->lines;
+	cursor->size = set->size;
+	cursor->next = 0;
+	cursor->chain = kernel->chase ? flat_ev_link(set) : NULL;
+}
@@ -0,0 +1,115 @@
+/**
+ * probe_kernel.h
+ *
+ * Family of timed probe windows, generated at compile time and picked at
+ * run time by name, so an experiment can trade sample rate against
+ * sensitivity without editing its timing loop.
+ *
+ * A kernel times one window of loads over a monitoring set. It is named
+ * <loads>-<mode>[-<fence>], e.g. "4-load" or "8-chase-full":
+ *
+ *   loads  1, 2, 4, 8 or 16 loads per window
+ *   mode   load: independent loads of consecutive lines, whose addresses
+ *          are read before the window opens
+ *          chase: dependent loads, following the chain of flat_ev_link()
+ *   fence  serial (default): serialized timer reads (arch_timestamp_serial)
+ *          full: also a full barrier (arch_fence) before each read, so the
+ *          window waits for every earlier memory access
+ *          none: plain timer reads, the cheapest and least precise
+ *
+ * Every kernel exists for both timer backends of util.h; select the one of
+ * the binary with TIMER_BACKEND. The kernels are called through a pointer,
+ * outside of the timed window.
+ *
+ *     const struct probe_kernel *kernel = probe_kernel_select(name, TIMER_BACKEND);
+ *     struct probe_cursor cursor;
+ *     probe_cursor_init(&cursor, kernel, monitoring_set);
+ *     latency = probe_kernel_run(kernel, &cursor, &timestamp);
+ */
+
+#ifndef PROBE_KERNEL_H_
+#define PROBE_KERNEL_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "flat_ev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum probe_fence {
+	PROBE_FENCE_SERIAL,
+	PROBE_FENCE_FULL,
+	PROBE_FENCE_NONE,
+};
+
+// Position of a kernel in the monitoring set
+struct probe_cursor {
+	void **lines;	// load: lines[next] is the next line
+	uint32_t size;
+	uint32_t next;
+	void **chain;	// chase: the next line
+};
+
+/*
+ * Times one window and advances the cursor past its lines. Returns the
+ * latency in ticks of the timer, and the timestamp of the window on the
+ * generic timer (comparable across cores) in *timestamp.
+ */
+typedef uint32_t (*probe_kernel_fn)(struct probe_cursor *cursor, uint64_t *timestamp);
+
+struct probe_kernel {
+	const char *name;	// canonical name, e.g. "4-load-serial"
+	const char *timer;	// TIMER_BACKEND
+	int loads;
+	bool chase;
+	enum probe_fence fence;
+	probe_kernel_fn run;
+};
+
+/*
+ * Kernel of the given name for the timer backend, NULL if there is none
+ */
+const struct probe_kernel *probe_kernel_find(const char *name, const char *timer_backend);
+
+/*
+ * Like probe_kernel_find(), but exits with the list of kernels if there is
+ * none
+ */
+const struct probe_kernel *probe_kernel_select(const char *name, const char *timer_backend);
+
+/*
+ * Prints the names of the kernels
+ */
+void probe_kernel_list(FILE *stream);
+
+/*
+ * Starts the cursor at the first line of the set. For chase kernels, the
+ * lines are linked with flat_ev_link().
+ */
+void probe_cursor_init(struct probe_cursor *cursor, const struct probe_kernel *kernel, const struct flat_ev *set);
+
+/*
+ * Moves the cursor back to the first line of the set
+ */
+static inline void probe_cursor_rewind(struct probe_cursor *cursor)
+{
+	cursor->next = 0;
+	if (cursor->chain != NULL) {
+		cursor->chain = (void **)cursor->lines[0];
+	}
+}
+
+static inline uint32_t probe_kernel_run(const struct probe_kernel *kernel, struct probe_cursor *cursor,
+										uint64_t *timestamp)
+{
+	return kernel->run(cursor, timestamp);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROBE_KERNEL_H_
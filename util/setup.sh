@@ -11,6 +11,13 @@
 # Provision some hugepages
 echo 2048 | sudo tee /proc/sys/vm/nr_hugepages
 
+# Mount hugetlbfs for the shared address pool, if it is not mounted yet
+mountpoint -q /dev/hugepages || sudo mount -t hugetlbfs -o mode=1777 none /dev/hugepages
+
+# Reserve and mount 1 GB hugepages, for builds with HUGEPAGE_1GB=1 (optional)
+# echo 4 | sudo tee /sys/kernel/mm/hugepages/hugepages-1048576kB/nr_hugepages
+# sudo mkdir -p /dev/hugepages1G && sudo mount -t hugetlbfs -o pagesize=1G,mode=1777 none /dev/hugepages1G
+
 # Disable transparent hugepages (optional)
 echo never | sudo tee /sys/kernel/mm/transparent_hugepage/enabled
 
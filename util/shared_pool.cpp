@@ -0,0 +1,207 @@
+/**
+ * shared_pool.cpp
+ *
+ * See shared_pool.h.
+ */
+
+#include "shared_pool.h"
+#include "pagemap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <unistd.h>
+#include <string>
+
+static std::string pool_path(const char *name, int page_shift)
+{
+	const char *dir = page_shift == 30 ? getenv("HUGETLBFS_DIR_1GB") : getenv("HUGETLBFS_DIR");
+	if (dir == NULL) {
+		dir = page_shift == 30 ? HUGETLBFS_DIR_1GB : HUGETLBFS_DIR;
+	}
+	return std::string(dir) + "/" + name;
+}
+
+/*
+ * Checks that the file is on a mount of pages of 1 << page_shift bytes
+ */
+static void check_page_size(int fd, int page_shift, const char *what)
+{
+	struct statfs fs;
+	if (fstatfs(fd, &fs) != 0) {
+		perror("fstatfs");
+		exit(1);
+	}
+	if (fs.f_type == HUGETLBFS_MAGIC && (size_t)fs.f_bsize != 1UL << page_shift) {
+		fprintf(stderr, "shared_pool: %s is on a mount of %lu kB pages instead of %lu kB, see util/setup.sh\n", what,
+				(unsigned long)fs.f_bsize >> 10, (1UL << page_shift) >> 10);
+		exit(1);
+	}
+}
+
+static std::string index_name(const char *name)
+{
+	return std::string("/") + name + "-index";
+}
+
+static std::string init_lock_name(const char *name)
+{
+	return std::string("/") + name + "-init";
+}
+
+/*
+ * Lets the processes of other users open a file this process created
+ * (the transmitters and the receiver may run as different users)
+ */
+static void share_file(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_uid == geteuid()) {
+		fchmod(fd, SHARED_POOL_MODE);
+	}
+}
+
+static void lock_file(int fd, int operation)
+{
+	if (flock(fd, operation) != 0) {
+		perror("flock shared_pool");
+		exit(1);
+	}
+}
+
+/*
+ * Sizes a file to size bytes if it is empty, and returns whether it was
+ */
+static bool size_file(int fd, size_t size, const char *what)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror("fstat");
+		exit(1);
+	}
+	if ((size_t)st.st_size == size) {
+		return false;
+	}
+	if (st.st_size != 0) {
+		fprintf(stderr, "shared_pool: %s has %lld bytes instead of %zu, remove it with cleanup.sh\n", what,
+				(long long)st.st_size, size);
+		exit(1);
+	}
+	if (ftruncate(fd, size) != 0) {
+		perror(what);
+		exit(1);
+	}
+	return true;
+}
+
+static void *map_shared(int fd, size_t size, const char *what)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (p == MAP_FAILED) {
+		perror(what);
+		exit(1);
+	}
+	return p;
+}
+
+struct shared_pool *shared_pool_open(const char *name, size_t size, int page_shift)
+{
+	size = hugepage_round(size, page_shift);
+	struct shared_pool *pool = new struct shared_pool;
+	pool->size = size;
+	pool->state_size = slice_index_state_size(size);
+
+	// Setting up and attaching are serialized by a lock file of their own,
+	// so that nobody attaches while the pool is set up, and nobody sets it
+	// up again while the lock on the pool changes from exclusive to shared
+	// (flock(2) does not convert locks atomically)
+	std::string init_lock = init_lock_name(name);
+	int init_fd = shm_open(init_lock.c_str(), O_RDWR | O_CREAT, SHARED_POOL_MODE);
+	if (init_fd < 0) {
+		perror(init_lock.c_str());
+		exit(1);
+	}
+	share_file(init_fd);
+	lock_file(init_fd, LOCK_EX);
+
+	std::string path = pool_path(name, page_shift);
+	pool->fd = open(path.c_str(), O_RDWR | O_CREAT, SHARED_POOL_MODE);
+	if (pool->fd < 0) {
+		perror(path.c_str());
+		exit(1);
+	}
+	share_file(pool->fd);
+	check_page_size(pool->fd, hugepage_shift(page_shift), path.c_str());
+
+	// Whoever finds the pool unused sets it up for this run
+	pool->created = flock(pool->fd, LOCK_EX | LOCK_NB) == 0;
+	if (!pool->created && errno != EWOULDBLOCK) {
+		perror("flock shared_pool");
+		exit(1);
+	}
+
+	bool new_pool = false;
+	if (pool->created) {
+		new_pool = size_file(pool->fd, size, path.c_str());
+	}
+	// Hugetlbfs pages are zeroed by the kernel, MAP_POPULATE faults them all in now
+	pool->buffer = map_shared(pool->fd, size, path.c_str());
+
+	std::string index = index_name(name);
+	int fd = shm_open(index.c_str(), O_RDWR | (pool->created ? O_CREAT : 0), SHARED_POOL_MODE);
+	if (fd < 0) {
+		perror(index.c_str());
+		exit(1);
+	}
+	share_file(fd);
+	if (pool->created && size_file(fd, pool->state_size, index.c_str())) {
+		new_pool = true;
+	}
+	pool->state = map_shared(fd, pool->state_size, index.c_str());
+	close(fd);
+
+	if (pool->created) {
+		// A pool left by an earlier run keeps its classification
+		pool->index = slice_index_create_in(pool->buffer, size, pool->state,
+											new_pool ? SLICE_INDEX_INIT : SLICE_INDEX_CLEAR_CLAIMS);
+	} else {
+		pool->index = slice_index_create_in(pool->buffer, size, pool->state, SLICE_INDEX_ATTACH);
+	}
+	lock_file(pool->fd, LOCK_SH);
+
+	lock_file(init_fd, LOCK_UN);
+	close(init_fd);
+	return pool;
+}
+
+void shared_pool_close(struct shared_pool *pool)
+{
+	slice_index_destroy(pool->index);
+	munmap(pool->state, pool->state_size);
+	munmap(pool->buffer, pool->size);
+	get_pagemap_translator().invalidate((uint64_t)pool->buffer, pool->size);
+	close(pool->fd);
+	delete pool;
+}
+
+void shared_pool_unlink(const char *name, int page_shift)
+{
+	std::string path = pool_path(name, page_shift);
+	if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+		perror(path.c_str());
+	}
+	std::string index = index_name(name);
+	if (shm_unlink(index.c_str()) != 0 && errno != ENOENT) {
+		perror(index.c_str());
+	}
+	std::string init_lock = init_lock_name(name);
+	if (shm_unlink(init_lock.c_str()) != 0 && errno != ENOENT) {
+		perror(init_lock.c_str());
+	}
+}
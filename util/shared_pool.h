@@ -0,0 +1,86 @@
+/**
+ * shared_pool.h
+ *
+ * Address pool shared by the processes of an experiment (e.g., the
+ * transmitters and the receiver), in place of one private hugepage buffer
+ * per process.
+ *
+ * A pool is a file of the given size on a hugetlbfs mount with the page
+ * size of hugepage.h (HUGEPAGE_1GB selects a mount of 1 GB pages and a pool
+ * of its own), mapped pre-faulted, and
+ * a slice index (see slice_index.h) whose state is in a POSIX shared memory
+ * object. Every process builds its sets from the shared index, which hands
+ * out disjoint lines. With the slice hash the processes set up concurrently;
+ * otherwise they take turns (see slice_index_setup_lock()), since the
+ * timing probe of one disturbs the others.
+ *
+ * The processes of a run hold a shared lock on the pool file. The first one
+ * to open the pool while nobody holds it creates it, or clears the lines
+ * handed out by the previous run, keeping the classification; the others
+ * wait for it and attach. Setting up and attaching are serialized by a
+ * second lock, on the POSIX shared memory object "/<name>-init". So the
+ * pool is classified once, and every run (e.g., of run-all-capacity.sh)
+ * starts with all of its lines available.
+ *
+ * The pool outlives the processes; shared_pool_unlink() (or cleanup.sh)
+ * removes it and gives the hugepages back.
+ */
+
+#ifndef SHARED_POOL_H_
+#define SHARED_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "hugepage.h"
+#include "slice_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HUGEPAGE_1GB
+#define SHARED_POOL_NAME "dont-mesh-around-pool-1g"
+#else
+#define SHARED_POOL_NAME "dont-mesh-around-pool"
+#endif
+// Mounts of 2 MB and 1 GB pages, overridden by $HUGETLBFS_DIR and
+// $HUGETLBFS_DIR_1GB
+#define HUGETLBFS_DIR "/dev/hugepages"
+#define HUGETLBFS_DIR_1GB "/dev/hugepages1G"
+// The pool may be shared by processes of different users
+#define SHARED_POOL_MODE 0666
+
+struct shared_pool {
+	void *buffer;
+	size_t size;
+	struct slice_index *index;
+	bool created;	// this process set up the pool for the run
+	int fd;	// holds the lock on the pool file
+	void *state;
+	size_t state_size;
+};
+
+/*
+ * Opens the pool, setting it up for a new run if no other process has it
+ * open. size is rounded up to a multiple of the page size (1 << page_shift,
+ * normally HUGEPAGE_SHIFT). Exits on failure, if the existing pool has a
+ * different size, or if the hugetlbfs mount has another page size.
+ */
+struct shared_pool *shared_pool_open(const char *name, size_t size, int page_shift);
+
+/*
+ * Unmaps the pool and releases the lock; it stays available to the other
+ * processes
+ */
+void shared_pool_close(struct shared_pool *pool);
+
+/*
+ * Removes the pool. Processes that have it mapped keep their mappings.
+ */
+void shared_pool_unlink(const char *name, int page_shift);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHARED_POOL_H_
@@ -1,5 +1,18 @@
+#ifndef SKX_HASH_UTILS_H_
+#define SKX_HASH_UTILS_H_
+
 #include <stdbool.h>
 
 #define ADDR_PTR uint64_t 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 int get_cha_with_hash(void* virtual_address, bool huge);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SKX_HASH_UTILS_H_
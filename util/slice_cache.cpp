@@ -0,0 +1,270 @@
+/**
+ * slice_cache.cpp
+ *
+ * See slice_cache.h. The file starts with a header page followed by a table
+ * of SLICE_CACHE_SLOTS 64-bit entries. Each entry packs the physical line
+ * number (physical frame number and line offset) with the slice:
+ *
+ *   entry = ((physical_address >> CACHE_BLOCK_SIZE_LOG) + 1) << 8 | slice
+ *
+ * An entry of 0 is an empty slot. Entries are only ever written with a
+ * compare-and-swap from 0, so processes can share the mapping without locks.
+ */
+
+#include "slice_cache.h"
+#include "machine_const.h"
+
+#include <fcntl.h>			// open
+#include <sys/file.h>		// flock
+#include <sys/mman.h>		// mmap
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLICE_CACHE_MAGIC 0x45484341434c5344UL	/* "DSLCACHE" */
+#define SLICE_CACHE_VERSION 2	// 2: load CPUs chosen by topology distance
+#define SLICE_CACHE_SIGNATURE_LEN 192
+#define SLICE_CACHE_HEADER_SIZE PAGE
+
+struct slice_cache_header {
+	uint64_t magic;
+	uint64_t version;
+	uint64_t slots;
+	// Identifies the hugepage backing the entries were collected on
+	char signature[SLICE_CACHE_SIGNATURE_LEN];
+	volatile uint64_t hits;
+	volatile uint64_t misses;
+	volatile uint64_t inserts;
+	volatile uint64_t entries;
+	volatile uint64_t invalidations;
+};
+
+static struct slice_cache_header *cache_header = NULL;
+static uint64_t *cache_table = NULL;
+static bool cache_disabled = false;
+static struct slice_cache_stats local_stats;
+
+/*
+ * Appends the first line of the given file (if any) to buf
+ */
+static void append_file_line(char *buf, size_t len, const char *path)
+{
+	char line[64] = "";
+	FILE *f = fopen(path, "r");
+	if (f) {
+		if (fgets(line, sizeof(line), f) == NULL) {
+			line[0] = '\0';
+		}
+		fclose(f);
+	}
+	line[strcspn(line, "\n")] = '\0';
+	strncat(buf, line, len - strlen(buf) - 1);
+	strncat(buf, ";", len - strlen(buf) - 1);
+}
+
+/*
+ * Describes the current hugepage backing: the physical frames handed out
+ * to the experiments can only change across reboots or when the hugepage
+ * pool is re-provisioned, and the probe results depend on the online CPUs.
+ */
+static void get_backing_signature(char *buf, size_t len)
+{
+	buf[0] = '\0';
+	append_file_line(buf, len, "/proc/sys/kernel/random/boot_id");
+	append_file_line(buf, len, "/proc/sys/vm/nr_hugepages");
+	append_file_line(buf, len, "/sys/devices/system/cpu/online");
+
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (f) {
+		char line[128];
+		while (fgets(line, sizeof(line), f)) {
+			if (strncmp(line, "Hugepagesize:", 13) == 0) {
+				line[strcspn(line, "\n")] = '\0';
+				strncat(buf, line + 13, len - strlen(buf) - 1);
+			}
+		}
+		fclose(f);
+	}
+}
+
+static void reset_table(const char *signature)
+{
+	memset(cache_table, 0, SLICE_CACHE_SLOTS * sizeof(*cache_table));
+	cache_header->magic = SLICE_CACHE_MAGIC;
+	cache_header->version = SLICE_CACHE_VERSION;
+	cache_header->slots = SLICE_CACHE_SLOTS;
+	strncpy(cache_header->signature, signature, SLICE_CACHE_SIGNATURE_LEN - 1);
+	cache_header->hits = 0;
+	cache_header->misses = 0;
+	cache_header->inserts = 0;
+	cache_header->entries = 0;
+	__atomic_add_fetch(&cache_header->invalidations, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Maps the cache file, creating or invalidating it if needed.
+ * Returns false if the cache cannot be used (the probe still works without it).
+ */
+static bool slice_cache_open(void)
+{
+	if (cache_table) {
+		return true;
+	}
+	if (cache_disabled) {
+		return false;
+	}
+
+	size_t file_size = SLICE_CACHE_HEADER_SIZE + SLICE_CACHE_SLOTS * sizeof(uint64_t);
+	int fd = open(SLICE_CACHE_FILE, O_RDWR | O_CREAT, 0666);
+	if (fd < 0) {
+		perror("slice_cache: open " SLICE_CACHE_FILE);
+		cache_disabled = true;
+		return false;
+	}
+
+	// Serialize creation/validation with the other processes
+	flock(fd, LOCK_EX);
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || (size_t)sb.st_size != file_size) {
+		if (ftruncate(fd, file_size) != 0) {
+			perror("slice_cache: ftruncate");
+			flock(fd, LOCK_UN);
+			close(fd);
+			cache_disabled = true;
+			return false;
+		}
+	}
+
+	void *map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("slice_cache: mmap");
+		flock(fd, LOCK_UN);
+		close(fd);
+		cache_disabled = true;
+		return false;
+	}
+
+	cache_header = (struct slice_cache_header *)map;
+	cache_table = (uint64_t *)((uint8_t *)map + SLICE_CACHE_HEADER_SIZE);
+
+	char signature[SLICE_CACHE_SIGNATURE_LEN];
+	get_backing_signature(signature, sizeof(signature));
+	if (cache_header->magic != SLICE_CACHE_MAGIC ||
+		cache_header->version != SLICE_CACHE_VERSION ||
+		cache_header->slots != SLICE_CACHE_SLOTS ||
+		strncmp(cache_header->signature, signature, SLICE_CACHE_SIGNATURE_LEN) != 0) {
+		reset_table(signature);
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+	return true;
+}
+
+static inline uint64_t slot_of(uint64_t line)
+{
+	// Fibonacci hashing
+	return (line * 0x9E3779B97F4A7C15UL) >> (64 - SLICE_CACHE_SLOTS_LOG);
+}
+
+int slice_cache_lookup(uint64_t physical_address)
+{
+	if (physical_address == 0 || !slice_cache_open()) {
+		return -1;
+	}
+
+	uint64_t key = (physical_address >> CACHE_BLOCK_SIZE_LOG) + 1;
+	uint64_t slot = slot_of(key);
+	for (int i = 0; i < SLICE_CACHE_MAX_PROBES; i++) {
+		uint64_t entry = __atomic_load_n(&cache_table[slot], __ATOMIC_ACQUIRE);
+		if (entry == 0) {
+			break;
+		}
+		if ((entry >> 8) == key) {
+			local_stats.hits++;
+			__atomic_add_fetch(&cache_header->hits, 1, __ATOMIC_RELAXED);
+			return (int)(entry & 0xff);
+		}
+		slot = (slot + 1) & (SLICE_CACHE_SLOTS - 1);
+	}
+
+	local_stats.misses++;
+	__atomic_add_fetch(&cache_header->misses, 1, __ATOMIC_RELAXED);
+	return -1;
+}
+
+void slice_cache_insert(uint64_t physical_address, uint8_t slice)
+{
+	if (physical_address == 0 || !slice_cache_open()) {
+		return;
+	}
+
+	uint64_t key = (physical_address >> CACHE_BLOCK_SIZE_LOG) + 1;
+	uint64_t new_entry = (key << 8) | slice;
+	uint64_t slot = slot_of(key);
+	for (int i = 0; i < SLICE_CACHE_MAX_PROBES; i++) {
+		uint64_t expected = 0;
+		if (__atomic_compare_exchange_n(&cache_table[slot], &expected, new_entry, false,
+										__ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			local_stats.inserts++;
+			__atomic_add_fetch(&cache_header->inserts, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&cache_header->entries, 1, __ATOMIC_RELAXED);
+			return;
+		}
+
+		// Someone else already recorded this line
+		if ((expected >> 8) == key) {
+			return;
+		}
+		slot = (slot + 1) & (SLICE_CACHE_SLOTS - 1);
+	}
+}
+
+void slice_cache_invalidate(void)
+{
+	if (!slice_cache_open()) {
+		return;
+	}
+
+	int fd = open(SLICE_CACHE_FILE, O_RDWR);
+	if (fd >= 0) {
+		flock(fd, LOCK_EX);
+	}
+
+	char signature[SLICE_CACHE_SIGNATURE_LEN];
+	get_backing_signature(signature, sizeof(signature));
+	reset_table(signature);
+
+	if (fd >= 0) {
+		flock(fd, LOCK_UN);
+		close(fd);
+	}
+}
+
+void slice_cache_get_stats(struct slice_cache_stats *stats)
+{
+	*stats = local_stats;
+	if (!slice_cache_open()) {
+		return;
+	}
+	stats->total_hits = cache_header->hits;
+	stats->total_misses = cache_header->misses;
+	stats->total_inserts = cache_header->inserts;
+	stats->entries = cache_header->entries;
+	stats->invalidations = cache_header->invalidations;
+}
+
+void slice_cache_print_stats(void)
+{
+	struct slice_cache_stats stats;
+	slice_cache_get_stats(&stats);
+
+	uint64_t lookups = stats.hits + stats.misses;
+	fprintf(stderr, "slice cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate), %" PRIu64 " inserts; "
+			"file holds %" PRIu64 "/%lu entries\n",
+			stats.hits, stats.misses, lookups ? 100.0 * stats.hits / lookups : 0.0, stats.inserts,
+			stats.entries, SLICE_CACHE_SLOTS);
+}
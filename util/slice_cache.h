@@ -0,0 +1,60 @@
+/**
+ * slice_cache.h
+ *
+ * Persistent, process-shared cache of physical cache line -> LLC slice
+ * mappings discovered by the timing probe (get_cache_slice_index).
+ *
+ * The slice a line maps to only depends on its physical address, so the
+ * results of the (very slow) timing probe can be kept across runs and shared
+ * between the transmitter, the receiver and the monitor. The cache lives in
+ * an mmap'd file and is keyed by physical frame number and line offset.
+ */
+
+#ifndef SLICE_CACHE_H_
+#define SLICE_CACHE_H_
+
+#include <inttypes.h>
+
+#define SLICE_CACHE_FILE "/var/tmp/.dont-mesh-around-slice-cache"
+
+// Number of slots in the open-addressed table (8 B each -> 32 MiB file).
+// A 400 MB buffer has 6.5M lines, but the builders only ever probe a
+// fraction of them.
+#define SLICE_CACHE_SLOTS_LOG 22
+#define SLICE_CACHE_SLOTS (1UL << SLICE_CACHE_SLOTS_LOG)
+
+// Give up inserting after this many probes (table is considered full)
+#define SLICE_CACHE_MAX_PROBES 64
+
+struct slice_cache_stats {
+	// Counters of this process
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t inserts;
+	// Counters accumulated in the file by all processes since the last invalidation
+	uint64_t total_hits;
+	uint64_t total_misses;
+	uint64_t total_inserts;
+	uint64_t entries;
+	uint64_t invalidations;
+};
+
+/*
+ * Returns the cached slice of the given physical address, or -1 on a miss.
+ */
+int slice_cache_lookup(uint64_t physical_address);
+
+/*
+ * Records the slice of the given physical address.
+ */
+void slice_cache_insert(uint64_t physical_address, uint8_t slice);
+
+/*
+ * Drops all the entries of the cache (for every process sharing it).
+ */
+void slice_cache_invalidate(void);
+
+void slice_cache_get_stats(struct slice_cache_stats *stats);
+void slice_cache_print_stats(void);
+
+#endif // SLICE_CACHE_H_
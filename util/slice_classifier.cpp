@@ -0,0 +1,203 @@
+/**
+ * slice_classifier.cpp
+ *
+ * See slice_classifier.h. The statistic used to compare two cores is the
+ * one-sided Welch z-score of their mean chunk times; with a few thousand
+ * loads per chunk the chunk times are close to normally distributed.
+ */
+
+#include "slice_classifier.h"
+#include "slice_probe.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+static std::mutex config_lock;
+static struct slice_classifier_config current_config = slice_classifier_default_config();
+
+static std::atomic<uint64_t> total_classifications(0);
+static std::atomic<uint64_t> total_loads(0);
+static std::atomic<uint64_t> total_low_confidence(0);
+
+// Number of wins of each pair of the probe pool, used to order the candidates
+static std::mutex wins_lock;
+static std::vector<uint64_t> wins;
+
+struct candidate_stats {
+	size_t pair;
+	bool active;
+	int n;
+	double mean;
+	double m2;	// sum of squared deviations (Welford)
+};
+
+struct slice_classifier_config slice_classifier_default_config(void)
+{
+	struct slice_classifier_config config;
+	config.confidence = 0.999;
+	config.chunk_loads = 2000;
+	config.min_chunks = 2;
+	config.max_loads = 32 * 100000; // what the fixed-budget probe spends
+	return config;
+}
+
+void set_slice_classifier_config(const struct slice_classifier_config *config)
+{
+	std::lock_guard<std::mutex> guard(config_lock);
+	current_config = *config;
+}
+
+struct slice_classifier_config get_slice_classifier_config(void)
+{
+	std::lock_guard<std::mutex> guard(config_lock);
+	return current_config;
+}
+
+static inline void add_sample(struct candidate_stats *c, double x)
+{
+	c->n++;
+	double delta = x - c->mean;
+	c->mean += delta / c->n;
+	c->m2 += delta * (x - c->mean);
+}
+
+/*
+ * Probability that a is faster (lower mean) than b.
+ * A candidate with a single sample borrows the variance of the other one.
+ */
+static double prob_faster(const struct candidate_stats *a, const struct candidate_stats *b)
+{
+	double var_a = a->n > 1 ? a->m2 / (a->n - 1) : 0;
+	double var_b = b->n > 1 ? b->m2 / (b->n - 1) : 0;
+	if (a->n < 2) {
+		var_a = var_b;
+	}
+	if (b->n < 2) {
+		var_b = var_a;
+	}
+	double se = sqrt(var_a / a->n + var_b / b->n);
+	double diff = b->mean - a->mean;
+	if (se == 0) {
+		return diff > 0 ? 1.0 : (diff == 0 ? 0.5 : 0.0);
+	}
+	return 0.5 * erfc(-(diff / se) / M_SQRT2);
+}
+
+struct slice_classification classify_slice(void *va, const struct slice_classifier_config *config)
+{
+	SliceProbePool &pool = get_slice_probe_pool();
+	struct slice_classification result = {-1, 0.0, 0, 0};
+	if (pool.size() == 0) {
+		return result;
+	}
+
+	// Order the candidates by how often they won so far
+	std::vector<size_t> order(pool.size());
+	std::iota(order.begin(), order.end(), 0);
+	{
+		std::lock_guard<std::mutex> guard(wins_lock);
+		wins.resize(pool.size(), 0);
+		std::stable_sort(order.begin(), order.end(), [](size_t a, size_t b) { return wins[a] > wins[b]; });
+	}
+
+	std::vector<struct candidate_stats> cands;
+	for (size_t pair : order) {
+		cands.push_back({pair, true, 0, 0.0, 0.0});
+	}
+
+	// Every candidate gets min_chunks samples, the likely winners first.
+	// Once a leader is established, a candidate whose first sample is
+	// already clearly slower is dropped right away.
+	for (auto &c : cands) {
+		do {
+			add_sample(&c, (double)pool.run(c.pair, va, config->chunk_loads));
+			result.loads += config->chunk_loads;
+			result.chunks++;
+
+			const struct candidate_stats *leader = NULL;
+			for (const auto &l : cands) {
+				if (&l != &c && l.active && l.n >= config->min_chunks && (!leader || l.mean < leader->mean)) {
+					leader = &l;
+				}
+			}
+			if (leader && prob_faster(leader, &c) >= config->confidence) {
+				c.active = false;
+			}
+		} while (c.active && c.n < config->min_chunks);
+	}
+
+	size_t best;
+	while (1) {
+		// Find the best and the runner-up
+		best = cands.size();
+		size_t runner_up = cands.size();
+		for (size_t i = 0; i < cands.size(); i++) {
+			if (!cands[i].active) {
+				continue;
+			}
+			if (best == cands.size() || cands[i].mean < cands[best].mean) {
+				runner_up = best;
+				best = i;
+			} else if (runner_up == cands.size() || cands[i].mean < cands[runner_up].mean) {
+				runner_up = i;
+			}
+		}
+
+		result.slice = pool.pair(cands[best].pair).probe_cpu;
+		result.confidence = runner_up == cands.size() ? 1.0 : prob_faster(&cands[best], &cands[runner_up]);
+
+		if (result.confidence >= config->confidence || result.loads >= config->max_loads) {
+			break;
+		}
+
+		// Drop the candidates that are clearly slower than the best one
+		for (size_t i = 0; i < cands.size(); i++) {
+			if (i != best && cands[i].active && prob_faster(&cands[best], &cands[i]) >= config->confidence) {
+				cands[i].active = false;
+			}
+		}
+
+		// One more sample for every surviving candidate
+		for (auto &c : cands) {
+			if (c.active) {
+				add_sample(&c, (double)pool.run(c.pair, va, config->chunk_loads));
+				result.loads += config->chunk_loads;
+				result.chunks++;
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(wins_lock);
+		wins[cands[best].pair]++;
+	}
+	total_classifications++;
+	total_loads += result.loads;
+	if (result.confidence < config->confidence) {
+		total_low_confidence++;
+	}
+
+	return result;
+}
+
+void slice_classifier_get_stats(struct slice_classifier_stats *stats)
+{
+	stats->classifications = total_classifications;
+	stats->loads = total_loads;
+	stats->low_confidence = total_low_confidence;
+}
+
+void slice_classifier_print_stats(void)
+{
+	struct slice_classifier_stats stats;
+	slice_classifier_get_stats(&stats);
+	fprintf(stderr, "slice classifier: %" PRIu64 " addresses, %.0f loads/address, %" PRIu64 " below confidence\n",
+			stats.classifications,
+			stats.classifications ? (double)stats.loads / stats.classifications : 0.0,
+			stats.low_confidence);
+}
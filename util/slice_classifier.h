@@ -0,0 +1,51 @@
+/**
+ * slice_classifier.h
+ *
+ * Adaptive, early-stopping version of the timing-based slice probe.
+ *
+ * Instead of timing a fixed 100k loads from every probe core, the candidates
+ * are sampled in small chunks (most frequently winning cores first) while
+ * keeping running latency statistics per core. Cores that are clearly slower
+ * than the current best are dropped, and sampling stops as soon as the best
+ * core beats the runner-up at the requested confidence level.
+ */
+
+#ifndef SLICE_CLASSIFIER_H_
+#define SLICE_CLASSIFIER_H_
+
+#include <inttypes.h>
+
+struct slice_classifier_config {
+	double confidence;		 // stop when P(best is faster than runner-up) reaches this
+	uint64_t chunk_loads;	 // loads per timed sample
+	int min_chunks;			 // samples every candidate gets before pruning
+	uint64_t max_loads;		 // budget per address (all cores together)
+};
+
+struct slice_classification {
+	int slice;				 // probe core of the winning pair, -1 if none
+	double confidence;		 // confidence reached when sampling stopped
+	uint64_t loads;			 // timed loads spent on this address
+	int chunks;				 // timed samples taken
+};
+
+struct slice_classifier_stats {
+	uint64_t classifications;
+	uint64_t loads;
+	uint64_t low_confidence;  // ran out of budget before reaching the confidence
+};
+
+struct slice_classifier_config slice_classifier_default_config(void);
+
+/*
+ * Configuration used by get_cache_slice_index()
+ */
+void set_slice_classifier_config(const struct slice_classifier_config *config);
+struct slice_classifier_config get_slice_classifier_config(void);
+
+struct slice_classification classify_slice(void *va, const struct slice_classifier_config *config);
+
+void slice_classifier_get_stats(struct slice_classifier_stats *stats);
+void slice_classifier_print_stats(void);
+
+#endif // SLICE_CLASSIFIER_H_
@@ -0,0 +1,161 @@
+/**
+ * slice_hash_batch.cpp
+ *
+ * See slice_hash_batch.h.
+ */
+
+#include "slice_hash_batch.h"
+#include "slice_hash.h"
+#include "pagemap.h"
+#include "machine_const.h"
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Addresses translated per call to the translator in hash_slices_batch
+#define BATCH_CHUNK 4096
+
+struct hash_tables {
+	const struct slice_hash_desc *hash;
+	uint64_t high_mask;
+	int n_bytes;
+	std::vector<std::array<uint32_t, 256>> bytes;
+};
+
+static std::mutex tables_lock;
+static std::vector<std::unique_ptr<struct hash_tables>> all_tables;
+
+const struct slice_hash_desc *get_machine_slice_hash(void)
+{
+#if SLICE_HASH_RECOVERED
+	static const struct slice_hash_desc machine_hash = {
+		SLICE_HASH_INDEX_BITS,
+		SLICE_HASH_HIGH_SHIFT,
+		(int)(sizeof(slice_hash_xor_map) / sizeof(slice_hash_xor_map[0])),
+		slice_hash_xor_map,
+		0,
+		slice_hash_base_seq,
+	};
+	return &machine_hash;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * Returns the byte-wise tables of the linear part of hash, built on first use.
+ */
+static const struct hash_tables *get_tables(const struct slice_hash_desc *hash)
+{
+	std::lock_guard<std::mutex> guard(tables_lock);
+	for (const auto &t : all_tables) {
+		if (t->hash == hash) {
+			return t.get();
+		}
+	}
+
+	auto t = std::make_unique<struct hash_tables>();
+	t->hash = hash;
+	t->high_mask = hash->n_high_bits >= 64 ? ~0ULL : (1ULL << hash->n_high_bits) - 1;
+	t->n_bytes = (hash->n_high_bits + 7) / 8;
+	t->bytes.resize(t->n_bytes);
+	for (int b = 0; b < t->n_bytes; b++) {
+		for (int v = 0; v < 256; v++) {
+			uint32_t m = 0;
+			for (int bit = 0; bit < 8 && 8 * b + bit < hash->n_high_bits; bit++) {
+				if (v & (1 << bit)) {
+					m ^= hash->xor_map[8 * b + bit];
+				}
+			}
+			t->bytes[b][v] = m;
+		}
+	}
+	all_tables.push_back(std::move(t));
+	return all_tables.back().get();
+}
+
+static inline uint32_t linear_part(const struct hash_tables *t, uint64_t physical_address)
+{
+	uint64_t high = ((physical_address >> t->hash->high_shift) ^ t->hash->high_xor) & t->high_mask;
+	uint32_t m = 0;
+	for (int b = 0; b < t->n_bytes; b++) {
+		m ^= t->bytes[b][(high >> (8 * b)) & 0xff];
+	}
+	return m;
+}
+
+void hash_slices_batch(const struct slice_hash_desc *hash, const uint64_t *va, uint8_t *slices, size_t n)
+{
+	const struct hash_tables *t = get_tables(hash);
+	const uint32_t index_mask = (1U << hash->index_bits) - 1;
+	PagemapTranslator &translator = get_pagemap_translator();
+
+	uint64_t pa[BATCH_CHUNK];
+	uint64_t last_high = ~0ULL;
+	uint32_t m = 0;
+
+	for (size_t base = 0; base < n; base += BATCH_CHUNK) {
+		size_t count = n - base < BATCH_CHUNK ? n - base : BATCH_CHUNK;
+		translator.translate(va + base, pa, count);
+
+		for (size_t i = 0; i < count; i++) {
+			if (pa[i] == 0) {
+				slices[base + i] = SLICE_HASH_NOT_PRESENT;
+				continue;
+			}
+			uint64_t high = pa[i] >> hash->high_shift;
+			if (high != last_high) {
+				m = linear_part(t, pa[i]);
+				last_high = high;
+			}
+			slices[base + i] = hash->base_seq[((pa[i] >> CACHE_BLOCK_SIZE_LOG) & index_mask) ^ m];
+		}
+	}
+}
+
+void hash_slices_of_range(const struct slice_hash_desc *hash, void *buffer, size_t size, uint8_t *slices)
+{
+	const struct hash_tables *t = get_tables(hash);
+	const uint32_t index_mask = (1U << hash->index_bits) - 1;
+	const uint64_t high_size = 1ULL << hash->high_shift;
+	PagemapTranslator &translator = get_pagemap_translator();
+
+	uint64_t start = (uint64_t)buffer;
+	uint64_t end = start + size;
+	translator.prefetch(start, size);
+
+	uint64_t va = start;
+	while (va < end) {
+		// One translation per page
+		uint64_t page_size = 1ULL << translator.page_shift(va);
+		uint64_t page_end = (va & ~(page_size - 1)) + page_size;
+		if (page_end > end) {
+			page_end = end;
+		}
+		uint64_t pa = translator.translate(va);
+
+		while (va < page_end) {
+			size_t i = (va - start) >> CACHE_BLOCK_SIZE_LOG;
+			if (pa == 0) {
+				slices[i] = SLICE_HASH_NOT_PRESENT;
+				va += CACHE_BLOCK_SIZE;
+				continue;
+			}
+
+			// One evaluation of the linear part per run of lines sharing the high bits
+			uint64_t run = high_size - (pa & (high_size - 1));
+			if (run > page_end - va) {
+				run = page_end - va;
+			}
+			uint32_t m = linear_part(t, pa);
+			uint64_t index = pa >> CACHE_BLOCK_SIZE_LOG;
+			for (uint64_t l = 0; l < (run >> CACHE_BLOCK_SIZE_LOG); l++, index++) {
+				slices[i + l] = hash->base_seq[(index & index_mask) ^ m];
+			}
+			va += run;
+			pa += run;
+		}
+	}
+}
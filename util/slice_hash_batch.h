@@ -0,0 +1,61 @@
+/**
+ * slice_hash_batch.h
+ *
+ * Batched evaluation of XOR-based slice hashes over many virtual addresses.
+ *
+ * A hash is described by a base sequence indexed by the low line address
+ * bits, XORed with a linear function of the high physical address bits
+ * (the shape of both the Intel hash in skx_hash_utils.c and the hashes
+ * generated by tools/slice-hash-recovery). The linear part is evaluated with
+ * one 256-entry table per byte of the high bits, and only once per run of
+ * lines sharing the same high bits. Each (huge) page is translated once.
+ */
+
+#ifndef SLICE_HASH_BATCH_H_
+#define SLICE_HASH_BATCH_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLICE_HASH_NOT_PRESENT 0xFF
+
+struct slice_hash_desc {
+	int index_bits;			  // line address bits indexing base_seq
+	int high_shift;			  // first physical address bit of the linear part
+	int n_high_bits;		  // number of entries of xor_map
+	const uint32_t *xor_map;  // index mask contributed by each high bit
+	uint64_t high_xor;		  // constant XORed into the high bits before hashing
+	const uint8_t *base_seq;  // 1 << index_bits slices
+};
+
+/*
+ * Hash of this machine from slice_hash.h, NULL if it was not recovered yet
+ */
+const struct slice_hash_desc *get_machine_slice_hash(void);
+
+/*
+ * Hash of the Intel Xeon Gold 5220R (defined in skx_hash_utils.c)
+ */
+extern const struct slice_hash_desc skx_slice_hash;
+
+/*
+ * Computes the slice of n virtual addresses. Addresses whose page is not
+ * present get SLICE_HASH_NOT_PRESENT.
+ */
+void hash_slices_batch(const struct slice_hash_desc *hash, const uint64_t *va, uint8_t *slices, size_t n);
+
+/*
+ * Computes the slice of every cache line of [buffer, buffer + size):
+ * slices[i] is the slice of buffer + i * CACHE_BLOCK_SIZE.
+ */
+void hash_slices_of_range(const struct slice_hash_desc *hash, void *buffer, size_t size, uint8_t *slices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SLICE_HASH_BATCH_H_
@@ -0,0 +1,409 @@
+/**
+ * slice_index.cpp
+ *
+ * See slice_index.h.
+ *
+ * The state of an index is one flat block, so that it can live in shared
+ * memory: a header with the cursors, then the slice of every line, then a
+ * taken flag per line. A line is handed out by whoever flips its taken flag
+ * first. The cursors only remember where the search for a free line should
+ * start: every line before a cursor is either on another slice or taken,
+ * and both are permanent, so a stale cursor costs a rescan and nothing else.
+ */
+
+#include "slice_index.h"
+#include "slice_hash_batch.h"
+#include "cache_geometry.h"
+#include "machine_const.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define NUM_CLASSES (L2_INDEX_STRIDE >> CACHE_BLOCK_SIZE_LOG)
+#define SLICE_UNKNOWN 0xFF	// not classified yet
+#define SLICE_INVALID 0xFE	// the probe could not classify it, never handed out
+#define MAX_INDEX_THREADS 16
+#define INDEX_MAGIC 0x78646e4965636c53ULL	// "SlceIndx"
+
+static_assert(sizeof(std::atomic<uint8_t>) == 1, "slices and taken flags are byte arrays");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "cursors must work across processes");
+
+struct index_state {
+	uint64_t magic;
+	uint64_t n_lines;
+	std::atomic<uint64_t> classified;
+	// Serializes the set construction of the processes (lazy mode)
+	pthread_mutex_t setup_lock;
+	// Serializes the classification of each class (lazy mode)
+	pthread_mutex_t class_lock[NUM_CLASSES];
+	// Lines of each class classified so far
+	std::atomic<uint32_t> class_cursor[NUM_CLASSES];
+	// First line of each (slice, class) that may be free, at slice * NUM_CLASSES + class
+	std::atomic<uint32_t> pop_cursor[NUM_CORES * NUM_CLASSES];
+	// First line of each class that may be free, for slice_index_pop_any
+	std::atomic<uint32_t> any_cursor[NUM_CLASSES];
+	// Followed by the slice of each line and the taken flag of each line
+};
+
+struct slice_index {
+	uint64_t start;
+	size_t n_lines;
+	struct index_state *state;
+	std::atomic<uint8_t> *slices;
+	std::atomic<uint8_t> *taken;
+	size_t state_size;
+	bool owns_state;
+	bool lazy;	// no slice hash, the lines are classified by the timing probe
+};
+
+uint32_t slice_index_class_of(void *va)
+{
+	return ((uint64_t)va >> CACHE_BLOCK_SIZE_LOG) & (NUM_CLASSES - 1);
+}
+
+/*
+ * Line number of the k-th line of class cls in the buffer
+ */
+static inline uint64_t class_line(const struct slice_index *index, uint32_t cls, uint64_t k)
+{
+	uint32_t first = (cls - slice_index_class_of((void *)index->start)) & (NUM_CLASSES - 1);
+	return first + k * NUM_CLASSES;
+}
+
+static inline void *line_address(const struct slice_index *index, uint64_t line)
+{
+	return (void *)(index->start + (line << CACHE_BLOCK_SIZE_LOG));
+}
+
+/*
+ * Moves a cursor forward to k, unless another process already moved it further
+ */
+static inline void advance(std::atomic<uint32_t> &cursor, uint32_t k)
+{
+	uint32_t current = cursor.load(std::memory_order_relaxed);
+	while (current < k && !cursor.compare_exchange_weak(current, k)) {
+	}
+}
+
+static void lock_robust(pthread_mutex_t *lock)
+{
+	if (pthread_mutex_lock(lock) == EOWNERDEAD) {
+		// A process died holding the lock; the lines it stored are valid
+		pthread_mutex_consistent(lock);
+	}
+}
+
+/*
+ * Makes sure the lines of class cls up to the k-th one are classified
+ */
+static void classify_up_to(struct slice_index *index, uint32_t cls, uint32_t k)
+{
+	std::atomic<uint32_t> &cursor = index->state->class_cursor[cls];
+	if (cursor.load(std::memory_order_acquire) > k) {
+		return;
+	}
+
+	lock_robust(&index->state->class_lock[cls]);
+	for (uint32_t next = cursor.load(); next <= k; next++) {
+		uint64_t line = class_line(index, cls, next);
+		if (line >= index->n_lines) {
+			break;
+		}
+		uint64_t slice = get_cache_slice_index(line_address(index, line));
+		index->slices[line].store(slice < NUM_CORES ? slice : SLICE_INVALID, std::memory_order_relaxed);
+		index->state->classified++;
+		cursor.store(next + 1, std::memory_order_release);
+	}
+	pthread_mutex_unlock(&index->state->class_lock[cls]);
+}
+
+/*
+ * First line of (slice, cls) that is not taken, without taking it.
+ * Returns n_lines if the buffer has none left.
+ */
+static uint64_t peek(struct slice_index *index, int slice, uint32_t cls)
+{
+	std::atomic<uint32_t> &cursor = index->state->pop_cursor[(size_t)slice * NUM_CLASSES + cls];
+	for (uint32_t k = cursor.load();; k++) {
+		uint64_t line = class_line(index, cls, k);
+		if (line >= index->n_lines) {
+			advance(cursor, k);
+			return index->n_lines;
+		}
+		classify_up_to(index, cls, k);
+		if (index->slices[line].load(std::memory_order_relaxed) == slice && !index->taken[line].load()) {
+			advance(cursor, k);
+			return line;
+		}
+	}
+}
+
+static inline bool take(struct slice_index *index, uint64_t line)
+{
+	return index->taken[line].exchange(1) == 0;
+}
+
+/*
+ * Classifies the whole buffer with the slice hash, split by address range
+ * across threads.
+ */
+static void classify_all(struct slice_index *index, const struct slice_hash_desc *hash)
+{
+	unsigned n_threads = std::thread::hardware_concurrency();
+	if (n_threads == 0) {
+		n_threads = 1;
+	} else if (n_threads > MAX_INDEX_THREADS) {
+		n_threads = MAX_INDEX_THREADS;
+	}
+	std::vector<std::thread> threads;
+
+	// Nothing else reads the slices while the state is initialized
+	uint8_t *slices = (uint8_t *)index->slices;
+	uint64_t chunk_lines = (index->n_lines + n_threads - 1) / n_threads;
+	for (unsigned t = 0; t < n_threads; t++) {
+		uint64_t first = t * chunk_lines;
+		if (first >= index->n_lines) {
+			break;
+		}
+		uint64_t n = index->n_lines - first < chunk_lines ? index->n_lines - first : chunk_lines;
+		threads.emplace_back([=]() {
+			hash_slices_of_range(hash, line_address(index, first), n << CACHE_BLOCK_SIZE_LOG, slices + first);
+			for (uint64_t line = first; line < first + n; line++) {
+				if (slices[line] >= NUM_CORES) {
+					slices[line] = SLICE_INVALID;
+				}
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	for (uint32_t cls = 0; cls < NUM_CLASSES; cls++) {
+		index->state->class_cursor[cls] = index->n_lines / NUM_CLASSES + 1;
+	}
+	index->state->classified = index->n_lines;
+}
+
+size_t slice_index_state_size(size_t size)
+{
+	size_t n_lines = size >> CACHE_BLOCK_SIZE_LOG;
+	return sizeof(struct index_state) + 2 * n_lines;
+}
+
+static void init_locks(struct index_state *state)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&state->setup_lock, &attr);
+	for (uint32_t cls = 0; cls < NUM_CLASSES; cls++) {
+		pthread_mutex_init(&state->class_lock[cls], &attr);
+	}
+	pthread_mutexattr_destroy(&attr);
+}
+
+static bool describes(const struct slice_index *index)
+{
+	return index->state->magic == INDEX_MAGIC && index->state->n_lines == index->n_lines;
+}
+
+static void init_state(struct slice_index *index)
+{
+	struct index_state *state = index->state;
+	memset((void *)state, 0, sizeof(*state));
+	state->magic = INDEX_MAGIC;
+	state->n_lines = index->n_lines;
+	init_locks(state);
+
+	memset((void *)index->slices, SLICE_UNKNOWN, index->n_lines);
+	memset((void *)index->taken, 0, index->n_lines);
+
+	const struct slice_hash_desc *hash = get_machine_slice_hash();
+	if (hash) {
+		classify_all(index, hash);
+	}
+}
+
+static void clear_claims(struct slice_index *index)
+{
+	struct index_state *state = index->state;
+	// Nobody else is using the state, so a lock left by a dead process can go
+	init_locks(state);
+	for (auto &cursor : state->pop_cursor) {
+		cursor = 0;
+	}
+	for (auto &cursor : state->any_cursor) {
+		cursor = 0;
+	}
+	memset((void *)index->taken, 0, index->n_lines);
+}
+
+struct slice_index *slice_index_create_in(void *buffer, size_t size, void *state, enum slice_index_mode mode)
+{
+	// The classes and the LLC sets below are those of machine_const.h
+	check_cache_geometry();
+
+	struct slice_index *index = new struct slice_index;
+	index->start = (uint64_t)buffer;
+	index->n_lines = size >> CACHE_BLOCK_SIZE_LOG;
+	index->state = (struct index_state *)state;
+	index->slices = (std::atomic<uint8_t> *)(index->state + 1);
+	index->taken = index->slices + index->n_lines;
+	index->state_size = slice_index_state_size(size);
+	index->owns_state = false;
+	index->lazy = get_machine_slice_hash() == NULL;
+
+	if (mode == SLICE_INDEX_CLEAR_CLAIMS && describes(index)) {
+		clear_claims(index);
+	} else if (mode != SLICE_INDEX_ATTACH) {
+		init_state(index);
+	} else if (!describes(index)) {
+		fprintf(stderr, "slice_index: the shared state does not describe a buffer of %zu bytes\n", size);
+		exit(1);
+	}
+	return index;
+}
+
+struct slice_index *slice_index_create(void *buffer, size_t size)
+{
+	size_t state_size = slice_index_state_size(size);
+	void *state = mmap(NULL, state_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (state == MAP_FAILED) {
+		perror("mmap slice_index");
+		exit(1);
+	}
+	struct slice_index *index = slice_index_create_in(buffer, size, state, SLICE_INDEX_INIT);
+	index->owns_state = true;
+	return index;
+}
+
+void slice_index_destroy(struct slice_index *index)
+{
+	if (index->owns_state) {
+		munmap(index->state, index->state_size);
+	}
+	delete index;
+}
+
+int slice_index_slice_of(struct slice_index *index, void *va)
+{
+	uint64_t line = ((uint64_t)va - index->start) >> CACHE_BLOCK_SIZE_LOG;
+	if (line >= index->n_lines) {
+		return get_cache_slice_index(va);
+	}
+	// Classify the lines of the class up to this one, to keep the classes in order
+	classify_up_to(index, slice_index_class_of(va), line / NUM_CLASSES);
+	uint8_t slice = index->slices[line].load(std::memory_order_relaxed);
+	return slice < NUM_CORES ? slice : -1;
+}
+
+void *slice_index_pop(struct slice_index *index, int slice, uint32_t cls)
+{
+	if (slice < 0 || slice >= NUM_CORES || cls >= NUM_CLASSES) {
+		return NULL;
+	}
+	while (1) {
+		uint64_t line = peek(index, slice, cls);
+		if (line >= index->n_lines) {
+			return NULL;
+		}
+		if (take(index, line)) {
+			return line_address(index, line);
+		}
+	}
+}
+
+void *slice_index_pop_any(struct slice_index *index, uint32_t cls)
+{
+	if (cls >= NUM_CLASSES) {
+		return NULL;
+	}
+	std::atomic<uint32_t> &cursor = index->state->any_cursor[cls];
+	for (uint32_t k = cursor.load();; k++) {
+		uint64_t line = class_line(index, cls, k);
+		if (line >= index->n_lines) {
+			advance(cursor, k);
+			return NULL;
+		}
+		if (take(index, line)) {
+			advance(cursor, k + 1);
+			return line_address(index, line);
+		}
+	}
+}
+
+size_t slice_index_pop_n(struct slice_index *index, int slice, uint32_t cls, void **lines, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		lines[i] = slice_index_pop(index, slice, cls);
+		if (lines[i] == NULL) {
+			break;
+		}
+	}
+	return i;
+}
+
+void *slice_index_pop_llc(struct slice_index *index, int slice, uint32_t llc_set)
+{
+	if (slice < 0 || slice >= NUM_CORES) {
+		return NULL;
+	}
+
+	// Of the classes sharing this LLC set, take the lowest address
+	const uint32_t llc_sets = (LLC_SET_INDEX_PER_SLICE_MASK >> CACHE_BLOCK_SIZE_LOG) + 1;
+	while (1) {
+		uint64_t best = index->n_lines;
+		for (uint32_t cls = llc_set; cls < NUM_CLASSES; cls += llc_sets) {
+			uint64_t line = peek(index, slice, cls);
+			if (line < best) {
+				best = line;
+			}
+		}
+		if (best >= index->n_lines) {
+			return NULL;
+		}
+		if (take(index, best)) {
+			return line_address(index, best);
+		}
+	}
+}
+
+size_t slice_index_pop_congruent(struct slice_index *index, int slice, uint32_t llc_set, void **lines, size_t n)
+{
+	if (n == 0) {
+		return 0;
+	}
+	lines[0] = slice_index_pop_llc(index, slice, llc_set);
+	if (lines[0] == NULL) {
+		return 0;
+	}
+	return 1 + slice_index_pop_n(index, slice, slice_index_class_of(lines[0]), lines + 1, n - 1);
+}
+
+void slice_index_setup_lock(struct slice_index *index)
+{
+	if (index->lazy) {
+		lock_robust(&index->state->setup_lock);
+	}
+}
+
+void slice_index_setup_unlock(struct slice_index *index)
+{
+	if (index->lazy) {
+		pthread_mutex_unlock(&index->state->setup_lock);
+	}
+}
+
+uint64_t slice_index_classified(const struct slice_index *index)
+{
+	return index->state->classified;
+}
@@ -0,0 +1,134 @@
+/**
+ * slice_index.h
+ *
+ * Index of the lines of an experiment buffer by (slice, congruence class).
+ *
+ * Two lines are in the same congruence class when they share the L2 set
+ * index, i.e., address bits [16-6]. Since these bits include the L1 set
+ * index [13-6] and the per-slice LLC set index [15-6], lines of a class on
+ * the same slice are congruent in the L1, the L2 and the LLC at once.
+ * These bits are those of machine_const.h; creating an index checks that
+ * they match the cache geometry of the machine (see cache_geometry.h).
+ * The buffer must be backed by hugepages so that these bits are the same
+ * in the virtual and the physical address.
+ *
+ * If the slice hash is available (see slice_hash_batch.h), the whole buffer
+ * is classified when the index is created. Otherwise the lines of a class
+ * are classified lazily, in address order and at most once each, the first
+ * time a line of that class is requested.
+ *
+ * Lines are handed out in increasing address order and never twice, so the
+ * eviction and monitoring sets built from one index are disjoint.
+ *
+ * The state of an index can also be placed in memory shared by several
+ * processes mapping the same buffer (see shared_pool.h). Lines are claimed
+ * with atomic operations, so the sets built by all the processes are
+ * disjoint too, and each line is classified once for all of them.
+ */
+
+#ifndef SLICE_INDEX_H_
+#define SLICE_INDEX_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct slice_index;
+
+/*
+ * Creates an index over [buffer, buffer + size).
+ */
+struct slice_index *slice_index_create(void *buffer, size_t size);
+
+/*
+ * Size of the state of an index over size bytes
+ */
+size_t slice_index_state_size(size_t size);
+
+enum slice_index_mode {
+	SLICE_INDEX_INIT,			// initialize the state and classify the buffer
+	SLICE_INDEX_CLEAR_CLAIMS,	// hand out every line again, keeping the classification
+	SLICE_INDEX_ATTACH,			// use the state as it is
+};
+
+/*
+ * Creates an index over [buffer, buffer + size) with its state in the
+ * given slice_index_state_size(size) bytes. SLICE_INDEX_INIT classifies the
+ * buffer if the slice hash is available. SLICE_INDEX_CLEAR_CLAIMS falls back
+ * to SLICE_INDEX_INIT if the state does not describe a buffer of this size.
+ * With SLICE_INDEX_ATTACH, the state belongs to an index over the same
+ * physical buffer, possibly in another process, and no other process may
+ * be initializing it.
+ */
+struct slice_index *slice_index_create_in(void *buffer, size_t size, void *state, enum slice_index_mode mode);
+
+/*
+ * Destroys an index. The state of slice_index_create_in() is left alone.
+ */
+void slice_index_destroy(struct slice_index *index);
+
+/*
+ * Congruence class of an address (its L2 set index)
+ */
+uint32_t slice_index_class_of(void *va);
+
+/*
+ * Returns the slice of a line of the buffer, classifying it if needed.
+ */
+int slice_index_slice_of(struct slice_index *index, void *va);
+
+/*
+ * Takes the next unused line on the given slice and congruence class.
+ * Returns NULL if the buffer has no such line left.
+ */
+void *slice_index_pop(struct slice_index *index, int slice, uint32_t cls);
+
+/*
+ * Takes the next unused line of the given congruence class, on any slice
+ * (for sets that only need to be congruent in the L1/L2). Does not classify.
+ */
+void *slice_index_pop_any(struct slice_index *index, uint32_t cls);
+
+/*
+ * Takes up to n lines on the given slice and congruence class.
+ * Returns the number of lines written to lines.
+ */
+size_t slice_index_pop_n(struct slice_index *index, int slice, uint32_t cls, void **lines, size_t n);
+
+/*
+ * Takes the next unused line on the given slice and LLC set (of any of the
+ * congruence classes mapping to that LLC set).
+ */
+void *slice_index_pop_llc(struct slice_index *index, int slice, uint32_t llc_set);
+
+/*
+ * Takes n lines on the given slice: the first one with slice_index_pop_llc()
+ * and the others in its congruence class. Returns the number of lines
+ * written to lines.
+ */
+size_t slice_index_pop_congruent(struct slice_index *index, int slice, uint32_t llc_set, void **lines, size_t n);
+
+/*
+ * Serializes the set construction of the processes sharing the index while
+ * its lines are classified lazily: the timing probe of one process would
+ * disturb the classification and the set validation of the others. Does
+ * nothing when the slice hash is available. A lock left by a process that
+ * died is taken over.
+ */
+void slice_index_setup_lock(struct slice_index *index);
+void slice_index_setup_unlock(struct slice_index *index);
+
+/*
+ * Number of lines classified so far
+ */
+uint64_t slice_index_classified(const struct slice_index *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SLICE_INDEX_H_
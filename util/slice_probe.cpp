@@ -0,0 +1,294 @@
+/**
+ * slice_probe.cpp
+ *
+ * See slice_probe.h. A measurement on pair i goes through these steps:
+ *
+ *   run():        write the job, bump generation, wake the pair
+ *   load thread:  set load_started, write the line until probe_done
+ *   probe thread: wait for load_started, time the loads, set probe_done
+ *   load thread:  set load_stopped
+ *   run():        return once load_stopped matches the generation
+ *
+ * All the handshakes are plain atomic stores and spins on per-pair
+ * generation numbers; the futex is only used to park idle workers.
+ */
+
+#include "slice_probe.h"
+#include "machine_const.h"
+#include "mesh_topology.h"
+#include "cpu_topology.h"
+#include "arch.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Spin this many times on a new generation before sleeping on the futex
+#define PROBE_SPIN_BEFORE_SLEEP (1 << 16)
+
+static inline void cpu_relax(void)
+{
+#if defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#elif defined(__x86_64__)
+	asm volatile("pause" ::: "memory");
+#endif
+}
+
+static inline uint64_t read_counter(void)
+{
+	return arch_timestamp();
+}
+
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t val)
+{
+	syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t> *addr)
+{
+	syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+
+static void pin_thread(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (ret != 0) {
+		fprintf(stderr, "slice probe: unable to pin worker to cpu %d: %s\n", cpu, strerror(ret));
+	}
+}
+
+/*
+ * Waits until the generation moves past `seen` and returns the new one
+ */
+uint32_t SliceProbePool::wait_for_job(Worker *w, uint32_t seen)
+{
+	uint32_t gen;
+	for (int spins = 0; (gen = w->generation.load(std::memory_order_acquire)) == seen; spins++) {
+		if (spins < PROBE_SPIN_BEFORE_SLEEP) {
+			cpu_relax();
+		} else {
+			futex_wait(&w->generation, seen);
+		}
+	}
+	return gen;
+}
+
+void *SliceProbePool::probe_main(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	uint32_t seen = 0;
+
+	while (1) {
+		seen = wait_for_job(w, seen);
+		if (w->shutdown.load(std::memory_order_acquire)) {
+			break;
+		}
+
+		// Wait for the load thread to start writing the line
+		while (w->load_started.load(std::memory_order_acquire) != seen) {
+			cpu_relax();
+		}
+
+		volatile uint64_t *p = w->va;
+		uint64_t repeat = w->repeat;
+		uint64_t res;
+
+		uint64_t start = read_counter();
+		for (uint64_t i = 0; i < repeat; i++) {
+			res = *p;
+		}
+		uint64_t end = read_counter();
+		(void)res;
+
+		w->elapsed = end - start;
+		w->probe_done.store(seen, std::memory_order_release);
+	}
+	return NULL;
+}
+
+void *SliceProbePool::load_main(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	uint32_t seen = 0;
+
+	while (1) {
+		seen = wait_for_job(w, seen);
+		if (w->shutdown.load(std::memory_order_acquire)) {
+			break;
+		}
+
+		volatile uint64_t *p = w->va;
+		w->load_started.store(seen, std::memory_order_release);
+		while (w->probe_done.load(std::memory_order_relaxed) != seen) {
+			*p = *p + 1;
+		}
+		w->load_stopped.store(seen, std::memory_order_release);
+	}
+	return NULL;
+}
+
+SliceProbePool::SliceProbePool(const std::vector<Pair> &pairs)
+{
+	for (const Pair &pair : pairs) {
+		std::unique_ptr<Worker> w(new Worker());
+		w->pair = pair;
+		w->generation = 0;
+		w->load_started = 0;
+		w->probe_done = 0;
+		w->load_stopped = 0;
+		w->shutdown = false;
+
+		if (pthread_create(&w->probe_thread, NULL, probe_main, w.get()) != 0 ||
+			pthread_create(&w->load_thread, NULL, load_main, w.get()) != 0) {
+			perror("slice probe: pthread_create");
+			exit(1);
+		}
+		pin_thread(w->probe_thread, pair.probe_cpu);
+		pin_thread(w->load_thread, pair.load_cpu);
+
+		workers.push_back(std::move(w));
+	}
+}
+
+SliceProbePool::~SliceProbePool()
+{
+	for (auto &w : workers) {
+		w->shutdown.store(true, std::memory_order_release);
+		w->generation.fetch_add(1, std::memory_order_acq_rel);
+		futex_wake(&w->generation);
+	}
+	for (auto &w : workers) {
+		pthread_join(w->probe_thread, NULL);
+		pthread_join(w->load_thread, NULL);
+	}
+}
+
+uint64_t SliceProbePool::run(size_t i, void *va, uint64_t repeat)
+{
+	std::lock_guard<std::mutex> guard(run_lock);
+	Worker *w = workers[i].get();
+
+	w->va = (volatile uint64_t *)va;
+	w->repeat = repeat;
+	uint32_t gen = w->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+	futex_wake(&w->generation);
+
+	while (w->load_stopped.load(std::memory_order_acquire) != gen) {
+		cpu_relax();
+	}
+	return w->elapsed;
+}
+
+/*
+ * Position of the tile of cpu on the die, from the generated mesh topology.
+ * Returns false if it is not known.
+ */
+static bool cpu_tile(int cpu, int *x, int *y)
+{
+#if MESH_TOPOLOGY_DISCOVERED
+	for (int row = 0; row < DIE_ROWS; row++) {
+		for (int col = 0; col < DIE_COLS; col++) {
+			int cha = die_layout[row][col];
+			if (cha >= 0 && cha < NUM_CHA && cha_id_to_cpu[cha] == cpu) {
+				*x = col;
+				*y = row;
+				return true;
+			}
+		}
+	}
+#endif
+	(void)cpu;
+	(void)x;
+	(void)y;
+	return false;
+}
+
+/*
+ * Usable CPU nearest to cpu other than itself: in the same package if
+ * possible, then the fewest mesh hops away if the tiles of both are known
+ * (see mesh_topology.h), else in the same cluster, and the closest CPU
+ * number among equals. -1 if there is none.
+ */
+static int nearest_cpu(int cpu, const std::vector<int> &usable)
+{
+	int package = get_cpu_package(cpu);
+	int cluster = get_cpu_cluster(cpu);
+	int x, y;
+	bool on_mesh = cpu_tile(cpu, &x, &y);
+	int best = -1;
+	int64_t best_distance = 0;
+	for (int c : usable) {
+		if (c == cpu) {
+			continue;
+		}
+		int64_t topology_distance;
+		int cx, cy;
+		if (on_mesh) {
+			// CPUs off the known tiles come after all of them
+			topology_distance = cpu_tile(c, &cx, &cy) ? abs(cx - x) + abs(cy - y) : INT32_MAX;
+		} else {
+			topology_distance = cluster < 0 || get_cpu_cluster(c) != cluster;
+		}
+		int64_t distance = ((int64_t)(get_cpu_package(c) != package) << 48) + (topology_distance << 24) + abs(c - cpu);
+		if (best < 0 || distance < best_distance) {
+			best = c;
+			best_distance = distance;
+		}
+	}
+	return best;
+}
+
+std::vector<SliceProbePool::Pair> get_default_probe_pairs(void)
+{
+	std::vector<int> usable = get_usable_cpus();
+	std::vector<bool> covered(usable.empty() ? 0 : usable.back() + 1, false);
+	std::vector<SliceProbePool::Pair> pairs;
+	int skipped = 0;
+
+	for (int cpu : usable) {
+		if (covered[cpu]) {
+			continue;
+		}
+		// The CPUs of a group share a tile, whose slice ID is its first usable CPU
+		std::vector<int> group;
+		for (int c : get_cpu_group(cpu)) {
+			if (std::binary_search(usable.begin(), usable.end(), c)) {
+				group.push_back(c);
+				covered[c] = true;
+			}
+		}
+		if (cpu >= NUM_CORES) {
+			skipped++;
+			continue;
+		}
+
+		int load_cpu = group.size() > 1 ? group[1] : nearest_cpu(cpu, usable);
+		if (load_cpu >= 0) {
+			pairs.push_back({cpu, load_cpu});
+		}
+	}
+
+	if (skipped > 0) {
+		fprintf(stderr, "slice probe: %d tiles above cpu %d are not probed, raise NUM_CORES in machine_const.h\n",
+				skipped, NUM_CORES - 1);
+	}
+	if (pairs.empty()) {
+		fprintf(stderr, "slice probe: no pair of usable cpus to probe with\n");
+	}
+	return pairs;
+}
+
+SliceProbePool &get_slice_probe_pool(void)
+{
+	static SliceProbePool pool(get_default_probe_pairs());
+	return pool;
+}
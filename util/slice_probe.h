@@ -0,0 +1,94 @@
+/**
+ * slice_probe.h
+ *
+ * Long-lived pool of pinned threads used by the timing-based slice probe
+ * (find_closest_slice in util.cpp).
+ *
+ * Each candidate slice is measured by a pair of threads: a load thread that
+ * keeps writing to the probed line and a probe thread that times repeated
+ * loads of it. The core closest to the line's slice sees the lowest latency.
+ * The threads are created and pinned once; a measurement only bumps a
+ * per-pair generation counter and spins until the pair reports back, so a
+ * probe costs only the timed loads. Idle workers sleep on a futex.
+ *
+ * run() is thread-safe: concurrent callers never share state, and their
+ * measurements are serialized (two concurrent measurements would disturb
+ * each other's timing anyway).
+ */
+
+#ifndef SLICE_PROBE_H_
+#define SLICE_PROBE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class SliceProbePool {
+public:
+	struct Pair {
+		int probe_cpu;
+		int load_cpu;
+	};
+
+	explicit SliceProbePool(const std::vector<Pair> &pairs);
+	~SliceProbePool();
+
+	SliceProbePool(const SliceProbePool &) = delete;
+	SliceProbePool &operator=(const SliceProbePool &) = delete;
+
+	size_t size() const { return workers.size(); }
+	const Pair &pair(size_t i) const { return workers[i]->pair; }
+
+	/*
+	 * Times `repeat` loads of va from the probe core of pair i while the
+	 * load core of the same pair writes to it. Returns the elapsed ticks.
+	 */
+	uint64_t run(size_t i, void *va, uint64_t repeat);
+
+private:
+	struct alignas(64) Worker {
+		Pair pair;
+		// Bumped by run() to start a measurement
+		std::atomic<uint32_t> generation;
+		// Set to the generation by the workers as the measurement progresses
+		alignas(64) std::atomic<uint32_t> load_started;
+		std::atomic<uint32_t> probe_done;
+		std::atomic<uint32_t> load_stopped;
+		std::atomic<bool> shutdown;
+		// Job description, written before the generation is bumped
+		alignas(64) volatile uint64_t *va;
+		uint64_t repeat;
+		uint64_t elapsed;
+		pthread_t probe_thread;
+		pthread_t load_thread;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::mutex run_lock;
+
+	static void *probe_main(void *arg);
+	static void *load_main(void *arg);
+	static uint32_t wait_for_job(Worker *w, uint32_t seen);
+};
+
+/*
+ * Default pairs, from the CPU topology in sysfs (see cpu_topology.h): one
+ * per tile of usable CPUs, i.e., per group of SMT siblings or per cluster,
+ * or per core if the CPUs are in neither. The first CPU of the tile
+ * probes, and its slice ID is that CPU; the second CPU of the tile loads,
+ * or the nearest other usable CPU if the tile has only one (by mesh hops
+ * once mesh_topology.h is generated, else by cluster). Offline,
+ * isolated and unaffine CPUs are skipped, as are tiles from NUM_CORES up.
+ */
+std::vector<SliceProbePool::Pair> get_default_probe_pairs(void);
+
+/*
+ * Process-wide pool, created on first use.
+ */
+SliceProbePool &get_slice_probe_pool(void);
+
+#endif // SLICE_PROBE_H_
@@ -0,0 +1,73 @@
+/**
+ * timer_config.cpp
+ *
+ * See timer_config.h.
+ */
+
+#include "timer_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static FILE *open_config(void)
+{
+	const char *path = getenv(TIMER_CONFIG_ENV);
+	return fopen(path ? path : TIMER_CONFIG_DEFAULT_PATH, "r");
+}
+
+bool timer_config_load(const char *backend, struct timer_config *config)
+{
+	FILE *f = open_config();
+	if (f == NULL) {
+		return false;
+	}
+
+	memset(config, 0, sizeof(*config));
+	size_t prefix_len = strlen(backend);
+	int found = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, backend, prefix_len) != 0 || line[prefix_len] != '.') {
+			continue;
+		}
+		char *key = line + prefix_len + 1;
+		char *value = strchr(key, '=');
+		if (value == NULL) {
+			continue;
+		}
+		*value++ = '\0';
+
+		if (strcmp(key, "tick_ghz") == 0) {
+			config->tick_ghz = strtod(value, NULL);
+		} else if (strcmp(key, "resolution_ticks") == 0) {
+			config->resolution_ticks = strtoull(value, NULL, 10);
+		} else if (strcmp(key, "overhead_ticks") == 0) {
+			config->overhead_ticks = strtoull(value, NULL, 10);
+		} else if (strcmp(key, "min_resolvable_loads") == 0) {
+			config->min_resolvable_loads = atoi(value);
+		} else if (strcmp(key, "load_ns") == 0) {
+			config->load_ns = strtod(value, NULL);
+		} else {
+			continue;
+		}
+		found++;
+	}
+	fclose(f);
+	return found > 0;
+}
+
+void timer_config_check(const char *backend, int loads_per_sample)
+{
+	struct timer_config config;
+	if (!timer_config_load(backend, &config)) {
+		return;
+	}
+
+	printf("Timer (%s): %.3f GHz, resolution %" PRIu64 " tick(s), overhead %" PRIu64 " tick(s), %d load(s) to resolve\n",
+		   backend, config.tick_ghz, config.resolution_ticks, config.overhead_ticks, config.min_resolvable_loads);
+	if (loads_per_sample < config.min_resolvable_loads) {
+		fprintf(stderr, "Warning: %d load(s) per sample is below the %d the %s timer resolves on this machine\n",
+				loads_per_sample, config.min_resolvable_loads, backend);
+	}
+}
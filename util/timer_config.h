@@ -0,0 +1,56 @@
+/**
+ * timer_config.h
+ *
+ * Timer characterization written by tools/timer-benchmark, as key=value
+ * lines, one set of keys per timer backend ("generic", "pmu"):
+ *
+ *   generic.tick_ghz=0.125
+ *   generic.resolution_ticks=1
+ *   generic.overhead_ticks=3
+ *   generic.min_resolvable_loads=2
+ *   generic.load_ns=11.8
+ *
+ * plus per-core keys (generic.core<N>.<stat>) that only the scripts read.
+ * The file is looked up in $TIMER_CONFIG, then in ../timer.conf (the root of
+ * the repository, seen from an experiment directory).
+ */
+
+#ifndef TIMER_CONFIG_H_
+#define TIMER_CONFIG_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMER_CONFIG_ENV "TIMER_CONFIG"
+#define TIMER_CONFIG_DEFAULT_PATH "../timer.conf"
+
+struct timer_config {
+	double tick_ghz;				// ticks per nanosecond
+	uint64_t resolution_ticks;		// smallest step between two reads
+	uint64_t overhead_ticks;		// median of two back-to-back serialized reads
+	int min_resolvable_loads;		// dependent LLC loads needed to move the median by one step
+	double load_ns;					// latency of one of these loads
+};
+
+/*
+ * Loads the keys of one backend. Returns false if there is no file or it
+ * has no keys for this backend.
+ */
+bool timer_config_load(const char *backend, struct timer_config *config);
+
+/*
+ * Prints the characterization of the backend a receiver was built with,
+ * and warns if a sample of loads_per_sample loads is below the resolution
+ * measured on this machine. Does nothing without a file.
+ */
+void timer_config_check(const char *backend, int loads_per_sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TIMER_CONFIG_H_
@@ -0,0 +1,318 @@
+/**
+ * trace_file.cpp
+ *
+ * See trace_file.h.
+ */
+
+#include "trace_file.h"
+#include "timer_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TRACE_ALIGN 64
+
+struct trace_column_header {
+	char name[24];
+	char dtype[8];
+	uint64_t offset;
+	uint64_t count;
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t n_columns;
+	uint32_t loads_per_sample;
+	uint64_t n_samples;
+	uint64_t interval;
+	double timestamp_ghz;
+	double latency_ghz;
+	char timer[16];
+	char kernel[24];
+	char placement[80];
+	uint32_t layout;
+	uint32_t record_size;
+	uint64_t dropped;
+	struct trace_column_header columns[TRACE_MAX_COLUMNS];
+};
+
+static_assert(sizeof(struct trace_column_header) == 48, "trace_file.py expects 48 B column headers");
+static_assert(sizeof(struct trace_header) == TRACE_HEADER_SIZE, "trace_file.py expects a 576 B header");
+static_assert(sizeof(struct trace_header) % TRACE_ALIGN == 0, "the first column must be aligned");
+
+static void copy_string(char *dst, size_t size, const char *src)
+{
+	if (src != NULL) {
+		strncpy(dst, src, size - 1);
+	}
+}
+
+void trace_info_init(struct trace_info *info, const char *timer_backend, uint32_t loads_per_sample)
+{
+	memset(info, 0, sizeof(*info));
+	info->loads_per_sample = loads_per_sample;
+	info->timer = timer_backend;
+
+	// The timestamps are always taken with the generic timer
+	struct timer_config config;
+	if (timer_config_load("generic", &config)) {
+		info->timestamp_ghz = config.tick_ghz;
+	}
+	if (timer_config_load(timer_backend, &config)) {
+		info->latency_ghz = config.tick_ghz;
+	}
+}
+
+/*
+ * Fills everything but the columns and the layout
+ */
+static void fill_header(struct trace_header *header, const struct trace_info *info, int n_columns, uint64_t n_samples)
+{
+	if (n_columns <= 0 || n_columns > TRACE_MAX_COLUMNS) {
+		fprintf(stderr, "trace: %d columns, at most %d\n", n_columns, TRACE_MAX_COLUMNS);
+		exit(1);
+	}
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	header->version = TRACE_VERSION;
+	header->header_size = sizeof(*header);
+	header->n_columns = n_columns;
+	header->loads_per_sample = info->loads_per_sample;
+	header->n_samples = n_samples;
+	header->interval = info->interval;
+	header->timestamp_ghz = info->timestamp_ghz;
+	header->latency_ghz = info->latency_ghz;
+	copy_string(header->timer, sizeof(header->timer), info->timer);
+	copy_string(header->kernel, sizeof(header->kernel), info->kernel);
+	copy_string(header->placement, sizeof(header->placement), info->placement);
+}
+
+void trace_write_columns(const char *path, const struct trace_info *info, const struct trace_column_data *columns,
+						 int n_columns)
+{
+	struct trace_header header;
+	fill_header(&header, info, n_columns, columns[0].count);
+
+	uint64_t size = sizeof(header);
+	for (int c = 0; c < n_columns; c++) {
+		struct trace_column_header *col = &header.columns[c];
+		copy_string(col->name, sizeof(col->name), columns[c].name);
+		snprintf(col->dtype, sizeof(col->dtype), "<u%zu", columns[c].elem_size);
+		col->offset = size;
+		col->count = columns[c].count;
+		size += (columns[c].count * columns[c].elem_size + TRACE_ALIGN - 1) & ~(uint64_t)(TRACE_ALIGN - 1);
+	}
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	if (ftruncate(fd, size) != 0) {
+		perror("ftruncate trace");
+		exit(1);
+	}
+	uint8_t *file = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (file == MAP_FAILED) {
+		perror("mmap trace");
+		exit(1);
+	}
+	close(fd);
+
+	memcpy(file, &header, sizeof(header));
+	for (int c = 0; c < n_columns; c++) {
+		memcpy(file + header.columns[c].offset, columns[c].data, columns[c].count * columns[c].elem_size);
+	}
+	munmap(file, size);
+}
+
+void trace_write_all(int fd, const void *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("trace write");
+			exit(1);
+		}
+		p += n;
+		size -= n;
+	}
+}
+
+static void check_delta_fields(const struct trace_field *fields, int n_fields)
+{
+	if (n_fields != 1 && n_fields != 2) {
+		fprintf(stderr, "trace: the delta layout takes a timestamp and a latency, not %d columns\n", n_fields);
+		exit(1);
+	}
+	if (fields[n_fields - 1].elem_size > 4) {
+		fprintf(stderr, "trace: the latencies of the delta layout are at most 4 B\n");
+		exit(1);
+	}
+}
+
+void trace_write_stream_header(int fd, const struct trace_info *info, const struct trace_field *fields, int n_fields,
+							   enum trace_layout layout, size_t record_size, uint64_t n_samples, uint64_t dropped)
+{
+	struct trace_header header;
+	fill_header(&header, info, n_fields, n_samples);
+	if (layout == TRACE_LAYOUT_DELTA) {
+		check_delta_fields(fields, n_fields);
+	}
+	header.layout = layout;
+	header.record_size = layout == TRACE_LAYOUT_RECORDS ? record_size : 0;
+	header.dropped = dropped;
+	for (int c = 0; c < n_fields; c++) {
+		struct trace_column_header *col = &header.columns[c];
+		copy_string(col->name, sizeof(col->name), fields[c].name);
+		snprintf(col->dtype, sizeof(col->dtype), "<u%zu", fields[c].elem_size);
+		col->offset = layout == TRACE_LAYOUT_RECORDS ? fields[c].offset : 0;
+		col->count = n_samples;
+	}
+
+	ssize_t written = pwrite(fd, &header, sizeof(header), 0);
+	if (written < 0 && errno == ESPIPE) {
+		written = write(fd, &header, sizeof(header));
+	}
+	if (written != (ssize_t)sizeof(header)) {
+		perror("trace header");
+		exit(1);
+	}
+}
+
+/*
+ * Unsigned integer of size bytes at p
+ */
+static inline uint64_t load_uint(const uint8_t *p, size_t size)
+{
+	uint8_t v8;
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+	switch (size) {
+	case 1:
+		memcpy(&v8, p, 1);
+		return v8;
+	case 2:
+		memcpy(&v16, p, 2);
+		return v16;
+	case 4:
+		memcpy(&v32, p, 4);
+		return v32;
+	default:
+		memcpy(&v64, p, 8);
+		return v64;
+	}
+}
+
+/*
+ * Encodes n samples whose timestamps (NULL if none) and latencies are
+ * ts_stride and lat_stride bytes apart
+ */
+static size_t encode_chunk(uint8_t *out, const uint8_t *timestamps, size_t ts_size, size_t ts_stride,
+						   const uint8_t *latencies, size_t lat_size, size_t lat_stride, uint32_t n)
+{
+	struct trace_delta_chunk chunk = {};
+	chunk.n_samples = n;
+	uint8_t *p = out + sizeof(chunk);
+
+	if (timestamps != NULL && n > 0) {
+		// The timestamps wrap around at their width
+		uint64_t mask = ts_size == 8 ? ~0ULL : (1ULL << (8 * ts_size)) - 1;
+		uint64_t prev = load_uint(timestamps, ts_size);
+		chunk.first_timestamp = prev;
+		for (uint32_t i = 0; i < n; i++) {
+			uint64_t t = load_uint(timestamps + i * ts_stride, ts_size);
+			uint64_t delta = (t - prev) & mask;
+			prev = t;
+			while (delta >= 0x80) {
+				*p++ = (delta & 0x7f) | 0x80;
+				delta >>= 7;
+			}
+			*p++ = delta;
+		}
+		chunk.timestamp_bytes = p - out - sizeof(chunk);
+	}
+
+	uint8_t *bytes = p;
+	p += n;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t latency = load_uint(latencies + i * lat_stride, lat_size);
+		if (latency < TRACE_DELTA_ESCAPE) {
+			bytes[i] = latency;
+		} else {
+			bytes[i] = TRACE_DELTA_ESCAPE;
+			memcpy(p, &latency, sizeof(latency));
+			p += sizeof(latency);
+			chunk.n_escapes++;
+		}
+	}
+
+	chunk.size = p - out;
+	memcpy(out, &chunk, sizeof(chunk));
+	return chunk.size;
+}
+
+size_t trace_delta_encode_records(uint8_t *out, const uint8_t *records, size_t record_size,
+								  const struct trace_field *fields, int n_fields, uint32_t n)
+{
+	const struct trace_field *latency = &fields[n_fields - 1];
+	const uint8_t *timestamps = n_fields == 2 ? records + fields[0].offset : NULL;
+	return encode_chunk(out, timestamps, fields[0].elem_size, record_size, records + latency->offset,
+						latency->elem_size, record_size, n);
+}
+
+void trace_write_delta(const char *path, const struct trace_info *info, const struct trace_column_data *columns,
+					   int n_columns)
+{
+	struct trace_field fields[2];
+	for (int c = 0; c < n_columns && c < 2; c++) {
+		fields[c] = {columns[c].name, 0, columns[c].elem_size};
+	}
+	check_delta_fields(fields, n_columns);
+	const struct trace_column_data *latency = &columns[n_columns - 1];
+	const struct trace_column_data *timestamp = n_columns == 2 ? &columns[0] : NULL;
+	if (timestamp != NULL && timestamp->count != latency->count) {
+		fprintf(stderr, "trace: %" PRIu64 " timestamps for %" PRIu64 " latencies\n", timestamp->count, latency->count);
+		exit(1);
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	trace_write_stream_header(fd, info, fields, n_columns, TRACE_LAYOUT_DELTA, 0, latency->count, 0);
+
+	uint8_t *out = (uint8_t *)malloc(trace_delta_bound(TRACE_DELTA_CHUNK));
+	if (out == NULL) {
+		perror("malloc trace");
+		exit(1);
+	}
+	if (lseek(fd, TRACE_HEADER_SIZE, SEEK_SET) < 0) {
+		perror("lseek trace");
+		exit(1);
+	}
+	for (uint64_t i = 0; i < latency->count; i += TRACE_DELTA_CHUNK) {
+		uint32_t n = latency->count - i < TRACE_DELTA_CHUNK ? latency->count - i : TRACE_DELTA_CHUNK;
+		const uint8_t *ts = timestamp ? (const uint8_t *)timestamp->data + i * timestamp->elem_size : NULL;
+		size_t size = encode_chunk(out, ts, timestamp ? timestamp->elem_size : 0, timestamp ? timestamp->elem_size : 0,
+								   (const uint8_t *)latency->data + i * latency->elem_size, latency->elem_size,
+								   latency->elem_size, n);
+		trace_write_all(fd, out, size);
+	}
+	free(out);
+	close(fd);
+}
@@ -0,0 +1,180 @@
+/**
+ * trace_file.h
+ *
+ * Binary trace files written by the receivers and monitors, and read by
+ * util/trace_file.py.
+ *
+ * A trace starts with a fixed header that describes it (the timers and
+ * their frequencies, the probe kernel, the placement, the interval) and
+ * lists its columns, which are little-endian unsigned integers laid out in
+ * one of two ways:
+ *
+ *  - TRACE_LAYOUT_COLUMNS: each column is a packed array at a 64 B aligned
+ *    offset, so a reader can map it as is. trace_write() writes the whole
+ *    file at once through a shared mapping.
+ *  - TRACE_LAYOUT_RECORDS: the samples are records of record_size bytes
+ *    from the end of the header on, and the offset of a column is its
+ *    offset in the record. Streams (see trace_stream.h) are written this
+ *    way, as they go; n_samples is 0 if the stream was not closed (or went
+ *    to a pipe), and the records then run to the end of the file.
+ *  - TRACE_LAYOUT_DELTA: the samples are compressed in chunks of at most
+ *    TRACE_DELTA_CHUNK samples, from the end of the header on, and the
+ *    columns are those of the decoded samples (offset 0). The columns are
+ *    an optional timestamp and a latency; a chunk is:
+ *
+ *        struct trace_delta_chunk
+ *        n_samples LEB128 varints: the difference of each timestamp with
+ *            the previous one (first_timestamp for the first), modulo the
+ *            width of the timestamps (none if there are no timestamps)
+ *        n_samples bytes: the latencies, TRACE_DELTA_ESCAPE if they do
+ *            not fit
+ *        n_escapes u32: the latencies that do not fit, in order
+ *
+ *    Consecutive timestamps are a nearly constant stride apart and most
+ *    latencies fit in a byte, so a sample usually takes 2 bytes instead of
+ *    8 or 12.
+ *
+ * Layout of the header, 576 B (offset: field):
+ *
+ *     0: magic "DMTRACE\0"            40: timestamp_ghz (double)
+ *     8: version, header_size (u32)   48: latency_ghz (double)
+ *    16: n_columns, loads_per_sample  56: timer (16 B string)
+ *    24: n_samples (u64)              72: kernel (24 B string)
+ *    32: interval (u64)               96: placement (80 B string)
+ *   176: layout, record_size (u32)   184: dropped samples (u64)
+ *   192: 8 columns of 48 B: name (24 B string), numpy dtype (8 B string,
+ *        e.g. "<u4"), offset (u64), count (u64)
+ */
+
+#ifndef TRACE_FILE_H_
+#define TRACE_FILE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_MAGIC "DMTRACE"
+// Version 1 had a 96 B placement and no layout, record_size and dropped
+// fields (always the columns layout)
+#define TRACE_VERSION 2
+#define TRACE_MAX_COLUMNS 8
+#define TRACE_HEADER_SIZE 576
+#define TRACE_DELTA_CHUNK 65536
+#define TRACE_DELTA_ESCAPE 0xff
+
+enum trace_layout {
+	TRACE_LAYOUT_COLUMNS = 0,
+	TRACE_LAYOUT_RECORDS = 1,
+	TRACE_LAYOUT_DELTA = 2,
+};
+
+struct trace_delta_chunk {
+	uint32_t n_samples;
+	uint32_t timestamp_bytes;	// of varints
+	uint32_t n_escapes;
+	uint32_t size;				// of the chunk, with this header
+	uint64_t first_timestamp;
+};
+
+struct trace_info {
+	uint64_t interval;			// channel interval in timestamp ticks, 0 if none
+	double timestamp_ghz;		// ticks per ns of the timestamps, 0 if unknown
+	double latency_ghz;			// ticks per ns of the latencies, 0 if unknown
+	uint32_t loads_per_sample;
+	const char *timer;			// timer backend of the latencies (TIMER_BACKEND)
+	const char *kernel;			// probe kernel, e.g. "load"
+	const char *placement;		// e.g. "core=2 slice=18"
+};
+
+struct trace_column_data {
+	const char *name;
+	const void *data;
+	size_t elem_size;	// 1, 2, 4 or 8 (unsigned integers)
+	uint64_t count;
+};
+
+// A column of a record
+struct trace_field {
+	const char *name;
+	size_t offset;
+	size_t elem_size;
+};
+
+/*
+ * Fills the frequencies from the timer characterization (see
+ * timer_config.h) of the backend, and leaves the rest empty
+ */
+void trace_info_init(struct trace_info *info, const char *timer_backend, uint32_t loads_per_sample);
+
+/*
+ * Writes a trace with n_columns columns to path. Exits on failure.
+ */
+void trace_write_columns(const char *path, const struct trace_info *info, const struct trace_column_data *columns,
+						 int n_columns);
+
+/*
+ * Writes a trace in the delta layout to path: columns are a timestamp and
+ * a latency, or a latency only, with elements of at most 8 and 4 bytes.
+ * Exits on failure.
+ */
+void trace_write_delta(const char *path, const struct trace_info *info, const struct trace_column_data *columns,
+					   int n_columns);
+
+// make TRACE_DELTA=1 writes the traces of the experiments in the delta layout
+#ifdef TRACE_DELTA
+#define TRACE_LAYOUT_SAMPLES TRACE_LAYOUT_DELTA
+#else
+#define TRACE_LAYOUT_SAMPLES TRACE_LAYOUT_COLUMNS
+#endif
+
+/*
+ * Writes a trace of samples in the layout chosen at build time
+ */
+static inline void trace_write(const char *path, const struct trace_info *info, const struct trace_column_data *columns,
+							   int n_columns)
+{
+	if (TRACE_LAYOUT_SAMPLES == TRACE_LAYOUT_DELTA) {
+		trace_write_delta(path, info, columns, n_columns);
+	} else {
+		trace_write_columns(path, info, columns, n_columns);
+	}
+}
+
+/*
+ * Writes the TRACE_HEADER_SIZE bytes of the header of a trace written as
+ * it goes, in the records or delta layout, to fd at offset 0 (pwrite), or
+ * at the current position if fd is not seekable. record_size is ignored in
+ * the delta layout. Exits on failure.
+ */
+void trace_write_stream_header(int fd, const struct trace_info *info, const struct trace_field *fields, int n_fields,
+							   enum trace_layout layout, size_t record_size, uint64_t n_samples, uint64_t dropped);
+
+/*
+ * Upper bound of the size of a chunk of n samples in the delta layout
+ */
+static inline size_t trace_delta_bound(uint32_t n)
+{
+	return sizeof(struct trace_delta_chunk) + (size_t)n * (10 + 1 + 4);
+}
+
+/*
+ * Encodes n records of record_size bytes (at most TRACE_DELTA_CHUNK) as a
+ * chunk of the delta layout into out, which holds trace_delta_bound(n)
+ * bytes, and returns its size. The fields are as for trace_write_delta().
+ */
+size_t trace_delta_encode_records(uint8_t *out, const uint8_t *records, size_t record_size,
+								  const struct trace_field *fields, int n_fields, uint32_t n);
+
+/*
+ * Writes size bytes to fd, retrying short writes. Exits on failure.
+ */
+void trace_write_all(int fd, const void *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACE_FILE_H_
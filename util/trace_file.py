@@ -0,0 +1,228 @@
+"""Reader of the traces written by the receivers and monitors.
+
+Traces are binary files in the format of util/trace_file.h: a header that
+describes the trace, then the samples, either as packed columns or as
+records (streams, see util/trace_stream.h), which are mapped without copying
+(numpy memmaps), or compressed in the delta layout, which is decoded with
+vectorized numpy operations. Text traces, with one sample per line and the
+columns separated by spaces, are still read, so older data keeps working.
+
+Streams written to a pipe are read as they come with iter_stream().
+"""
+
+import os
+import struct
+import sys
+from collections import namedtuple
+
+import numpy as np
+
+TRACE_MAGIC = b'DMTRACE\0'
+HEADER = struct.Struct('<8sIIIIQQdd16s24s80sIIQ')
+# Version 1: a longer placement instead of layout, record_size and dropped
+HEADER_V1 = struct.Struct('<8sIIIIQQdd16s24s96s')
+COLUMN = struct.Struct('<24s8sQQ')
+MAX_COLUMNS = 8
+HEADER_SIZE = 576
+LAYOUT_COLUMNS = 0
+LAYOUT_RECORDS = 1
+LAYOUT_DELTA = 2
+DELTA_CHUNK = struct.Struct('<IIIIQ')
+DELTA_ESCAPE = 0xff
+
+Trace = namedtuple('Trace', 'info columns')
+
+
+def _string(raw):
+    return raw.split(b'\0', 1)[0].decode()
+
+
+def is_binary_trace(path):
+    """Return True if path is a binary trace."""
+    with open(path, 'rb') as f:
+        return f.read(len(TRACE_MAGIC)) == TRACE_MAGIC
+
+
+def _parse_header(raw):
+    """Return the info dict and the column descriptors of a binary header."""
+    version = struct.unpack_from('<I', raw, 8)[0]
+    if version == 1:
+        (_, version, header_size, n_columns, loads_per_sample, n_samples, interval, timestamp_ghz,
+         latency_ghz, timer, kernel, placement) = HEADER_V1.unpack_from(raw)
+        layout, record_size, dropped = LAYOUT_COLUMNS, 0, 0
+    else:
+        (_, version, header_size, n_columns, loads_per_sample, n_samples, interval, timestamp_ghz,
+         latency_ghz, timer, kernel, placement, layout, record_size, dropped) = HEADER.unpack_from(raw)
+    info = {
+        'version': version,
+        'header_size': header_size,
+        'layout': layout,
+        'record_size': record_size,
+        'n_samples': n_samples,
+        'dropped': dropped,
+        'loads_per_sample': loads_per_sample,
+        'interval': interval,
+        'timestamp_ghz': timestamp_ghz,
+        'latency_ghz': latency_ghz,
+        'timer': _string(timer),
+        'kernel': _string(kernel),
+        'placement': dict(kv.split('=', 1) for kv in _string(placement).split() if '=' in kv),
+        'column_names': [],
+    }
+    columns = []
+    for c in range(n_columns):
+        name, dtype, offset, count = COLUMN.unpack_from(raw, HEADER.size + c * COLUMN.size)
+        info['column_names'].append(_string(name))
+        columns.append((_string(name), _string(dtype), offset, count))
+    return info, columns
+
+
+def _record_dtype(info, columns):
+    return np.dtype({
+        'names': [c[0] for c in columns],
+        'formats': [c[1] for c in columns],
+        'offsets': [c[2] for c in columns],
+        'itemsize': info['record_size'],
+    })
+
+
+def _decode_varints(data):
+    """Decode consecutive LEB128 varints (a uint8 array) to a uint64 array."""
+    if len(data) == 0:
+        return np.zeros(0, dtype=np.uint64)
+    last = (data & 0x80) == 0
+    starts = np.concatenate(([0], np.flatnonzero(last)[:-1] + 1))
+    varint = np.concatenate(([0], np.cumsum(last[:-1])))
+    shifts = ((np.arange(len(data)) - starts[varint]) * 7).astype(np.uint64)
+    return np.add.reduceat((data & 0x7f).astype(np.uint64) << shifts, starts)
+
+
+def _decode_delta(body, columns):
+    """Decode the chunks of the delta layout in body (a uint8 array).
+
+    A truncated last chunk (a stream that was not closed) is ignored.
+    Returns the list of columns.
+    """
+    counts, firsts, varints, latencies, escapes = [], [], [], [], []
+    pos = 0
+    while pos + DELTA_CHUNK.size <= len(body):
+        n, timestamp_bytes, n_escapes, size, first = DELTA_CHUNK.unpack_from(body, pos)
+        if pos + size > len(body):
+            break
+        p = pos + DELTA_CHUNK.size
+        counts.append(n)
+        firsts.append(first)
+        varints.append(body[p:p + timestamp_bytes])
+        p += timestamp_bytes
+        latencies.append(body[p:p + n])
+        p += n
+        escapes.append(body[p:p + 4 * n_escapes].view('<u4'))
+        pos += size
+
+    latency_dtype = columns[-1][1]
+    if not counts:
+        return [np.zeros(0, dtype=c[1]) for c in columns]
+    latency_bytes = np.concatenate(latencies)
+    latency = latency_bytes.astype(latency_dtype)
+    latency[latency_bytes == DELTA_ESCAPE] = np.concatenate(escapes)
+    if len(columns) == 1:
+        return [latency]
+
+    # Each chunk restarts from its first timestamp
+    deltas = _decode_varints(np.concatenate(varints))
+    total = np.cumsum(deltas, dtype=np.uint64)
+    counts = np.array(counts)
+    starts = np.concatenate(([0], np.cumsum(counts)[:-1]))
+    before = total[starts] - deltas[starts]
+    timestamp = total + np.repeat(np.array(firsts, dtype=np.uint64) - before, counts)
+    return [timestamp.astype(columns[0][1]), latency]
+
+
+def read_trace(path):
+    """Read a trace.
+
+    Returns a Trace whose info is a dict with the fields of the header
+    (empty for text traces) and whose columns is a list of 1-D arrays.
+    """
+    if not is_binary_trace(path):
+        data = np.loadtxt(path, dtype=np.int64, ndmin=2)
+        return Trace({}, [data[:, c] for c in range(data.shape[1])])
+
+    with open(path, 'rb') as f:
+        info, columns = _parse_header(f.read(HEADER_SIZE))
+
+    if info['layout'] == LAYOUT_DELTA:
+        body = np.fromfile(path, dtype=np.uint8, offset=info['header_size'])
+        arrays = _decode_delta(body, columns)
+        info['n_samples'] = len(arrays[-1])
+        return Trace(info, arrays)
+
+    if info['layout'] == LAYOUT_RECORDS:
+        dtype = _record_dtype(info, columns)
+        n = info['n_samples']
+        if n == 0:
+            # Not closed: the records run to the end of the file
+            n = (os.path.getsize(path) - info['header_size']) // dtype.itemsize
+            info['n_samples'] = n
+        if n == 0:
+            return Trace(info, [np.zeros(0, dtype=c[1]) for c in columns])
+        records = np.memmap(path, dtype=dtype, mode='r', offset=info['header_size'], shape=(n,))
+        return Trace(info, [records[c[0]] for c in columns])
+
+    arrays = []
+    for _, dtype, offset, count in columns:
+        if count == 0:
+            arrays.append(np.zeros(0, dtype=dtype))
+        else:
+            arrays.append(np.memmap(path, dtype=dtype, mode='r', offset=offset, shape=(count,)))
+    return Trace(info, arrays)
+
+
+def iter_stream(f, records_per_read=65536):
+    """Read a stream from a file object (e.g. sys.stdin.buffer) as it comes.
+
+    Yields (info, columns) for every read (every chunk in the delta
+    layout), columns being a list of 1-D arrays.
+    """
+    info, columns = _parse_header(f.read(HEADER_SIZE))
+    if info['layout'] == LAYOUT_DELTA:
+        while True:
+            head = f.read(DELTA_CHUNK.size)
+            if len(head) < DELTA_CHUNK.size:
+                break
+            rest = f.read(DELTA_CHUNK.unpack(head)[3] - DELTA_CHUNK.size)
+            yield info, _decode_delta(np.frombuffer(head + rest, dtype=np.uint8), columns)
+        return
+    if info['layout'] != LAYOUT_RECORDS:
+        raise ValueError('not a stream')
+    dtype = _record_dtype(info, columns)
+    pending = b''
+    while True:
+        chunk = f.read(records_per_read * dtype.itemsize)
+        if not chunk:
+            break
+        data = pending + chunk
+        n = len(data) // dtype.itemsize
+        pending = data[n * dtype.itemsize:]
+        records = np.frombuffer(data, dtype=dtype, count=n)
+        yield info, [records[c[0]] for c in columns]
+
+
+def read_columns(path):
+    """Read the columns of a trace, as a list of 1-D arrays."""
+    return read_trace(path).columns
+
+
+def main():
+    """Print a trace as text, one sample per line."""
+    if len(sys.argv) != 2:
+        print(f'Usage: {sys.argv[0]} <trace>', file=sys.stderr)
+        sys.exit(1)
+    trace = read_trace(sys.argv[1])
+    for key, value in trace.info.items():
+        print(f'# {key}: {value}')
+    np.savetxt(sys.stdout, np.column_stack(trace.columns), fmt='%d')
+
+
+if __name__ == '__main__':
+    main()
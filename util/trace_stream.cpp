@@ -0,0 +1,214 @@
+/**
+ * trace_stream.cpp
+ *
+ * See trace_stream.h. The writer polls the head of the ring, so the
+ * producer never has to wake it up.
+ */
+
+#include "trace_stream.h"
+#include "cpu_topology.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define WRITER_POLL_NS 100000
+
+struct trace_stream_writer {
+	int fd;
+	bool seekable;
+	enum trace_layout layout;
+	uint8_t *encoded;	// chunk of the delta layout
+	int stop;
+	uint64_t records;
+	pthread_t thread;
+	// Copies of the description, for the final header
+	std::string timer, kernel, placement;
+	std::vector<std::string> names;
+	struct trace_info info;
+	std::vector<struct trace_field> fields;
+};
+
+static int reserved_stdout = -1;
+
+void trace_stream_reserve_stdout(void)
+{
+	fflush(stdout);
+	reserved_stdout = dup(STDOUT_FILENO);
+	if (reserved_stdout < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		perror("trace_stream_reserve_stdout");
+		exit(1);
+	}
+}
+
+int trace_stream_quiet_cpu(void)
+{
+	const char *env = getenv("TRACE_WRITER_CPU");
+	if (env != NULL) {
+		return atoi(env);
+	}
+
+	std::vector<int> busy = get_cpu_group(sched_getcpu());
+	std::vector<int> usable = get_usable_cpus();
+	for (auto it = usable.rbegin(); it != usable.rend(); it++) {
+		if (std::find(busy.begin(), busy.end(), *it) == busy.end()) {
+			return *it;
+		}
+	}
+	return -1;
+}
+
+static void *writer_main(void *arg)
+{
+	struct trace_stream *stream = (struct trace_stream *)arg;
+	struct trace_stream_writer *w = stream->writer;
+	struct timespec poll = {0, WRITER_POLL_NS};
+
+	while (1) {
+		// The producer hands over its last block before it sets stop
+		int stop = __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE);
+		uint64_t head = __atomic_load_n(&stream->head, __ATOMIC_ACQUIRE);
+		if (stream->tail == head) {
+			if (stop) {
+				break;
+			}
+			nanosleep(&poll, NULL);
+			continue;
+		}
+
+		uint32_t b = stream->tail % TRACE_STREAM_BLOCKS;
+		uint8_t *block = stream->ring + b * stream->block_size;
+		if (w->layout == TRACE_LAYOUT_DELTA) {
+			size_t size = trace_delta_encode_records(w->encoded, block, stream->record_size, w->fields.data(),
+													 w->fields.size(), stream->block_fill[b]);
+			trace_write_all(w->fd, w->encoded, size);
+		} else {
+			trace_write_all(w->fd, block, (size_t)stream->block_fill[b] * stream->record_size);
+		}
+		w->records += stream->block_fill[b];
+		__atomic_store_n(&stream->tail, stream->tail + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+struct trace_stream *trace_stream_open_layout(const char *path, const struct trace_info *info,
+											  const struct trace_field *fields, int n_fields, size_t record_size,
+											  int writer_cpu, enum trace_layout layout)
+{
+	struct trace_stream *stream = new struct trace_stream();
+	struct trace_stream_writer *w = new struct trace_stream_writer();
+	stream->writer = w;
+	stream->record_size = record_size;
+	stream->block_size = record_size * TRACE_STREAM_BLOCK_RECORDS;
+	w->layout = layout;
+
+	// Keep the description for the final header
+	w->timer = info->timer ? info->timer : "";
+	w->kernel = info->kernel ? info->kernel : "";
+	w->placement = info->placement ? info->placement : "";
+	w->info = *info;
+	w->info.timer = w->timer.c_str();
+	w->info.kernel = w->kernel.c_str();
+	w->info.placement = w->placement.c_str();
+	for (int c = 0; c < n_fields; c++) {
+		w->names.push_back(fields[c].name);
+	}
+	for (int c = 0; c < n_fields; c++) {
+		w->fields.push_back({w->names[c].c_str(), fields[c].offset, fields[c].elem_size});
+	}
+
+	if (strcmp(path, "-") == 0) {
+		w->fd = reserved_stdout >= 0 ? reserved_stdout : STDOUT_FILENO;
+		// A live consumer that goes away ends the recording with EPIPE
+		signal(SIGPIPE, SIG_IGN);
+	} else {
+		w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (w->fd < 0) {
+			perror(path);
+			exit(1);
+		}
+	}
+	struct stat st;
+	w->seekable = fstat(w->fd, &st) == 0 && S_ISREG(st.st_mode);
+	trace_write_stream_header(w->fd, &w->info, w->fields.data(), n_fields, layout, record_size, 0, 0);
+	if (layout == TRACE_LAYOUT_DELTA) {
+		w->encoded = new uint8_t[trace_delta_bound(TRACE_STREAM_BLOCK_RECORDS)];
+	}
+	if (w->seekable && lseek(w->fd, TRACE_HEADER_SIZE, SEEK_SET) < 0) {
+		perror("lseek trace");
+		exit(1);
+	}
+
+	// Fault the ring in now rather than in the timing loop
+	size_t ring_size = stream->block_size * TRACE_STREAM_BLOCKS;
+	stream->ring = (uint8_t *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_POPULATE, -1, 0);
+	if (stream->ring == MAP_FAILED) {
+		perror("mmap trace_stream");
+		exit(1);
+	}
+	stream->block_fill = new uint32_t[TRACE_STREAM_BLOCKS]();
+	stream->block = stream->ring;
+
+	if (pthread_create(&w->thread, NULL, writer_main, stream) != 0) {
+		perror("trace_stream: pthread_create");
+		exit(1);
+	}
+	if (writer_cpu < 0) {
+		writer_cpu = trace_stream_quiet_cpu();
+	}
+	if (writer_cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(writer_cpu, &set);
+		int ret = pthread_setaffinity_np(w->thread, sizeof(set), &set);
+		if (ret != 0) {
+			fprintf(stderr, "trace_stream: unable to pin the writer to cpu %d: %s\n", writer_cpu, strerror(ret));
+		}
+	} else {
+		fprintf(stderr, "trace_stream: no quiet cpu for the writer, it shares the cpus of the process\n");
+	}
+	return stream;
+}
+
+void trace_stream_close(struct trace_stream *stream)
+{
+	struct trace_stream_writer *w = stream->writer;
+
+	// The writer drains the ring meanwhile, so the last block always fits eventually
+	if (stream->fill > 0) {
+		while (stream->head + 1 - __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE) >= TRACE_STREAM_BLOCKS) {
+			sched_yield();
+		}
+		trace_stream_flush_block(stream);
+	}
+	__atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(w->thread, NULL);
+
+	if (w->seekable) {
+		trace_write_stream_header(w->fd, &w->info, w->fields.data(), w->fields.size(), w->layout, stream->record_size,
+								  w->records, stream->dropped);
+	}
+	if (w->fd != STDOUT_FILENO && w->fd != reserved_stdout) {
+		close(w->fd);
+	}
+	fprintf(stderr, "Stream: %" PRIu64 " records written, %" PRIu64 " dropped in %" PRIu64 " overruns\n", w->records,
+			stream->dropped, stream->overruns);
+
+	munmap(stream->ring, stream->block_size * TRACE_STREAM_BLOCKS);
+	delete[] stream->block_fill;
+	delete[] w->encoded;
+	delete w;
+	delete stream;
+}
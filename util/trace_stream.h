@@ -0,0 +1,142 @@
+/**
+ * trace_stream.h
+ *
+ * Streaming capture of samples to a trace of records (see trace_file.h),
+ * for recordings that do not fit in memory.
+ *
+ * The timing loop (the producer) writes its records straight into blocks
+ * of a single-producer/single-consumer ring, and a writer thread pinned to
+ * a quiet core drains the full blocks to the trace file, or to a pipe for
+ * live consumers (see iter_stream in trace_file.py). The producer never
+ * waits and never makes a system call: if the ring is full when it
+ * completes a block, it drops that block and counts its records, and the
+ * count ends up in the header of the trace. With make TRACE_DELTA=1, the
+ * writer compresses the blocks to the delta layout (see trace_file.h) as
+ * it writes them out.
+ *
+ *     struct trace_stream *s = trace_stream_open(path, &info, fields, 2, sizeof(struct sample), -1);
+ *     while (...) {
+ *         struct sample *r = (struct sample *)trace_stream_slot(s);
+ *         r->latency = ...;
+ *         trace_stream_commit(s);
+ *     }
+ *     trace_stream_close(s);
+ */
+
+#ifndef TRACE_STREAM_H_
+#define TRACE_STREAM_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "trace_file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_STREAM_BLOCK_RECORDS 4096
+#define TRACE_STREAM_BLOCKS 256
+
+struct trace_stream_writer;
+
+struct trace_stream {
+	// Written by the producer only
+	uint8_t *block;			// block being filled
+	uint32_t fill;			// records in it
+	uint32_t record_size;
+	uint64_t head;			// blocks handed to the writer
+	uint64_t dropped;		// records dropped because the ring was full
+	uint64_t overruns;		// blocks dropped
+
+	// Written by the writer thread only
+	uint64_t tail __attribute__((aligned(64)));	// blocks written out
+
+	// Set up by trace_stream_open()
+	uint8_t *ring __attribute__((aligned(64)));
+	uint32_t *block_fill;	// records in each block handed to the writer
+	size_t block_size;
+	struct trace_stream_writer *writer;
+};
+
+/*
+ * Opens a stream of records of record_size bytes with the given fields to
+ * path, or to the standard output if path is "-", and starts the writer
+ * thread on writer_cpu, or on trace_stream_quiet_cpu() if it is negative.
+ * The trace is in the records or the delta layout. Exits on failure.
+ */
+struct trace_stream *trace_stream_open_layout(const char *path, const struct trace_info *info,
+											  const struct trace_field *fields, int n_fields, size_t record_size,
+											  int writer_cpu, enum trace_layout layout);
+
+/*
+ * Opens a stream in the layout chosen at build time
+ */
+static inline struct trace_stream *trace_stream_open(const char *path, const struct trace_info *info,
+													 const struct trace_field *fields, int n_fields,
+													 size_t record_size, int writer_cpu)
+{
+	enum trace_layout layout = TRACE_LAYOUT_SAMPLES == TRACE_LAYOUT_DELTA ? TRACE_LAYOUT_DELTA : TRACE_LAYOUT_RECORDS;
+	return trace_stream_open_layout(path, info, fields, n_fields, record_size, writer_cpu, layout);
+}
+
+/*
+ * Hands the last (partial) block to the writer, waits until everything is
+ * written, completes the header if the output is a file, and prints the
+ * number of records written and dropped to stderr.
+ */
+void trace_stream_close(struct trace_stream *stream);
+
+/*
+ * CPU for the writer thread: $TRACE_WRITER_CPU if set, else the last
+ * usable CPU outside the tile of the calling thread, -1 if there is none
+ */
+int trace_stream_quiet_cpu(void);
+
+/*
+ * Keeps the standard output for a stream to "-", and sends what the
+ * process prints to stdout to stderr instead. Call it before printing
+ * anything.
+ */
+void trace_stream_reserve_stdout(void);
+
+/*
+ * Hands the current block to the writer, or drops it if the ring is full
+ */
+static inline void trace_stream_flush_block(struct trace_stream *stream)
+{
+	uint64_t tail = __atomic_load_n(&stream->tail, __ATOMIC_ACQUIRE);
+	// The next block must be free to go on with
+	if (stream->head + 1 - tail < TRACE_STREAM_BLOCKS) {
+		stream->block_fill[stream->head % TRACE_STREAM_BLOCKS] = stream->fill;
+		__atomic_store_n(&stream->head, stream->head + 1, __ATOMIC_RELEASE);
+		stream->block = stream->ring + (stream->head % TRACE_STREAM_BLOCKS) * stream->block_size;
+	} else {
+		stream->dropped += stream->fill;
+		stream->overruns++;
+	}
+	stream->fill = 0;
+}
+
+/*
+ * Slot of the next record, record_size bytes
+ */
+static inline void *trace_stream_slot(struct trace_stream *stream)
+{
+	return stream->block + (size_t)stream->fill * stream->record_size;
+}
+
+/*
+ * Adds the record written to the slot to the stream
+ */
+static inline void trace_stream_commit(struct trace_stream *stream)
+{
+	if (++stream->fill == TRACE_STREAM_BLOCK_RECORDS) {
+		trace_stream_flush_block(stream);
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACE_STREAM_H_
@@ -8,27 +8,77 @@
 #include <stdio.h>
 #include <sched.h>
 #include "machine_const.h"
+#include "arch.h"
+#ifdef TIMER_PMU
+#include "perf_timer.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 uint64_t get_cache_set_index(uint64_t addr, int cache_level);
-uint64_t find_next_address_on_slice_and_set(void *va, uint8_t desired_slice, uint32_t desired_set);
 
 /* 
  * Gets the value Time Stamp Counter 
  */
-inline uint64_t get_time(void)
+ARCH_INLINE uint64_t get_time(void)
 {
-	uint64_t t;
-	asm volatile(
-		"isb\n"
-		"mrs %0, cntvct_el0\n"
-		"isb" : "=r" (t));
-	return t;
+	return arch_timestamp_serial();
 }
 
-uint64_t start_time(void);
-uint64_t stop_time(void);
+/*
+ * Timer for the timed windows around loads, selected per binary:
+ * compiling with -DTIMER_PMU reads the PMU cycle counter (see
+ * perf_timer.h), otherwise the same counter as get_time() is read.
+ *
+ * TIMER_IS_GLOBAL tells whether the values are comparable across cores
+ * and with get_time(). When it is 0, take timestamps with get_time().
+ */
+#ifdef TIMER_PMU
+
+#define TIMER_IS_GLOBAL 0
+#define TIMER_NAME "PMU cycle counter"
+#define TIMER_BACKEND "pmu"	// key prefix in timer_config.h
 
-inline void wait_cycles(uint64_t delay)
+ARCH_INLINE void timer_init(void)
+{
+	perf_timer_init();
+}
+
+ARCH_INLINE uint64_t start_time(void)
+{
+	return perf_timer_read_serial();
+}
+
+ARCH_INLINE uint64_t stop_time(void)
+{
+	return perf_timer_read_serial();
+}
+
+#else
+
+#define TIMER_IS_GLOBAL 1
+#define TIMER_NAME "generic timer"
+#define TIMER_BACKEND "generic"
+
+ARCH_INLINE void timer_init(void)
+{
+}
+
+ARCH_INLINE uint64_t start_time(void)
+{
+	return arch_timestamp_serial();
+}
+
+ARCH_INLINE uint64_t stop_time(void)
+{
+	return arch_timestamp_serial();
+}
+
+#endif
+
+static inline void wait_cycles(uint64_t delay)
 {
 	uint64_t cycles, end;
 	cycles = get_time();
@@ -38,9 +88,9 @@ inline void wait_cycles(uint64_t delay)
 	}
 }
 
-inline void maccess(void *p)
+ARCH_INLINE void maccess(void *p)
 {
-	asm volatile("ldr x0, [%0]" : : "r"(p) : "x0");
+	arch_load(p);
 }
 
 struct Node {
@@ -64,6 +114,8 @@ static void pin_cpu(size_t core_ID)
 	}
 }
 
-void flush_l1i(void);
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+/**
+ * window_stats.cpp
+ *
+ * See window_stats.h.
+ */
+
+#include "window_stats.h"
+
+#include <stddef.h>
+#include <string.h>
+
+const struct trace_field window_stats_fields[5] = {
+	{"window", offsetof(struct window_stats, window), sizeof(uint64_t)},
+	{"count", offsetof(struct window_stats, count), sizeof(uint32_t)},
+	{"above", offsetof(struct window_stats, above), sizeof(uint32_t)},
+	{"sum", offsetof(struct window_stats, sum), sizeof(uint64_t)},
+	{"sumsq", offsetof(struct window_stats, sumsq), sizeof(uint64_t)},
+};
+
+void window_aggregator_init(struct window_aggregator *agg, struct trace_stream *stream, uint64_t sync, uint64_t interval,
+							uint32_t threshold)
+{
+	memset(agg, 0, sizeof(*agg));
+	agg->stream = stream;
+	agg->sync = sync;
+	agg->interval = interval;
+	agg->threshold = threshold;
+	agg->current = &agg->slots[0];
+	agg->current_start = sync;
+}
+
+/*
+ * Writes out the window of a slot if it has samples, and empties the slot
+ */
+static void emit(struct window_aggregator *agg, struct window_stats *slot)
+{
+	if (slot->count > 0) {
+		memcpy(trace_stream_slot(agg->stream), slot, sizeof(*slot));
+		trace_stream_commit(agg->stream);
+	}
+	memset(slot, 0, sizeof(*slot));
+}
+
+bool window_aggregator_locate(struct window_aggregator *agg, uint64_t timestamp)
+{
+	if (timestamp < agg->sync) {
+		agg->late++;
+		return false;
+	}
+	uint64_t window = (timestamp - agg->sync) / agg->interval;
+	if (window < agg->base) {
+		agg->late++;
+		return false;
+	}
+
+	if (window >= agg->base + WINDOW_STATS_SLOTS) {
+		// The windows between the ring and the new one had no samples
+		uint64_t base = window - WINDOW_STATS_SLOTS + 1;
+		uint64_t end = base < agg->base + WINDOW_STATS_SLOTS ? base : agg->base + WINDOW_STATS_SLOTS;
+		for (uint64_t w = agg->base; w < end; w++) {
+			emit(agg, &agg->slots[w % WINDOW_STATS_SLOTS]);
+		}
+		agg->base = base;
+	}
+
+	agg->current = &agg->slots[window % WINDOW_STATS_SLOTS];
+	agg->current->window = window;
+	agg->current_start = agg->sync + window * agg->interval;
+	return true;
+}
+
+void window_aggregator_flush(struct window_aggregator *agg)
+{
+	for (uint64_t w = agg->base; w < agg->base + WINDOW_STATS_SLOTS; w++) {
+		emit(agg, &agg->slots[w % WINDOW_STATS_SLOTS]);
+	}
+	agg->base += WINDOW_STATS_SLOTS;
+}
@@ -0,0 +1,96 @@
+/**
+ * window_stats.h
+ *
+ * Per-window aggregation of the samples of a receiver, for the
+ * experiments that only use per-interval statistics downstream (e.g.,
+ * print-errors.py counts the samples above a threshold in each interval).
+ *
+ * The samples are bucketed by (timestamp - sync) / interval as they are
+ * taken, into a small ring of windows that stays in the L1. Each window
+ * keeps the count, sum, sum of squares of the latencies and the count of
+ * those at or above a threshold. A window is written to the stream (see
+ * trace_stream.h) when it leaves the ring, WINDOW_STATS_SLOTS windows
+ * later, or at the end; empty windows are not written.
+ *
+ *     struct window_aggregator agg;
+ *     window_aggregator_init(&agg, stream, sync, interval, threshold);
+ *     while (...) {
+ *         window_aggregator_add(&agg, timestamp, latency);
+ *     }
+ *     window_aggregator_flush(&agg);
+ */
+
+#ifndef WINDOW_STATS_H_
+#define WINDOW_STATS_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "trace_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WINDOW_STATS_SLOTS 64
+
+// A record of the trace
+struct window_stats {
+	uint64_t window;	// (timestamp - sync) / interval
+	uint32_t count;
+	uint32_t above;		// latencies >= threshold
+	uint64_t sum;
+	uint64_t sumsq;
+};
+
+struct window_aggregator {
+	// Window of the last sample, the fast path
+	struct window_stats *current;
+	uint64_t current_start;	// timestamp
+	uint64_t interval;
+	uint32_t threshold;
+
+	uint64_t sync;
+	uint64_t base;			// oldest window in the ring
+	uint64_t late;			// samples dropped because their window was gone
+	struct trace_stream *stream;
+	struct window_stats slots[WINDOW_STATS_SLOTS];
+};
+
+/*
+ * Fields of the records, for trace_stream_open()
+ */
+extern const struct trace_field window_stats_fields[5];
+
+void window_aggregator_init(struct window_aggregator *agg, struct trace_stream *stream, uint64_t sync, uint64_t interval,
+							uint32_t threshold);
+
+/*
+ * Makes the window of timestamp the current one, writing out the windows
+ * that leave the ring. Returns false if the window already left it (or
+ * timestamp is before sync).
+ */
+bool window_aggregator_locate(struct window_aggregator *agg, uint64_t timestamp);
+
+/*
+ * Writes out the windows left in the ring
+ */
+void window_aggregator_flush(struct window_aggregator *agg);
+
+static inline void window_aggregator_add(struct window_aggregator *agg, uint64_t timestamp, uint32_t latency)
+{
+	// Unsigned, so it also catches timestamps before the current window
+	if (timestamp - agg->current_start >= agg->interval && !window_aggregator_locate(agg, timestamp)) {
+		return;
+	}
+	struct window_stats *w = agg->current;
+	w->count++;
+	w->above += latency >= agg->threshold;
+	w->sum += latency;
+	w->sumsq += (uint64_t)latency * latency;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WINDOW_STATS_H_